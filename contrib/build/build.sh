@@ -1,7 +1,7 @@
 #!/bin/sh
 ##
 ## Toggle between library and non-library builds. Fix messed up libtool environment
-## Build and run haveged-devel sample
+## Build and run haveged-devel sample or online test benchmark
 ##
 case "$1" in
 nolib)
@@ -30,9 +30,19 @@ sample)
     echo "./havege_sample > /dev/null"
     ./havege_sample > /dev/null
 ;;
+bench)
+    echo "gcc -o havege_bench -O2 -I../.. -I../../src -Wall havege_bench.c ../../src/.libs/libhavege.a"
+    gcc -o havege_bench -O2 -I../.. -I../../src -Wall havege_bench.c ../../src/.libs/libhavege.a
+    echo "./havege_bench $2"
+    ./havege_bench $2
+;;
+ring)
+    echo "gcc -o havege_ring -O2 -DUSE_SOURCE -I../../src -Wall havege_ring.c ../../src/.libs/libhavege.a"
+    gcc -o havege_ring -O2 -DUSE_SOURCE -I../../src -Wall havege_ring.c ../../src/.libs/libhavege.a
+;;
 
 *)
-    echo "usage: build [new|nolib|lib|sample]";
+    echo "usage: build [new|nolib|lib|sample|bench <file>|ring]";
 ;;
 esac
 
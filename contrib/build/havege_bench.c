@@ -0,0 +1,152 @@
+/*
+Online test throughput benchmark - feeds a file through the AIS-31 procedures
+using the H_DEBUG_TEST_IN injection diagnostic and reports MB/s and the CPU
+time used by each test for the tot and continuous configurations.
+
+Requires a source tree configured with --enable-diagnostic and built with
+the library. From this directory, for an in-tree build:
+
+gcc -o havege_bench -O2 -I../.. -I../../src -Wall havege_bench.c ../../src/.libs/libhavege.a
+./havege_bench -n 64 /path/to/sample
+
+The input is read into memory once and injected cyclically, so file I/O is not
+measured. Throughput is the input consumed by the tests, which is less than the
+injected input for the tot tests since the collector is only partially filled
+during start up. The counters wrap at 512 MB, so keep -n below that. Input that fails the tests still reports timings, since failures only
+stop the current configuration. Use a known good sample, e.g. haveged output,
+to benchmark the passing path.
+
+*/
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "havegetest.h"
+
+#if !defined(RAW_IN_ENABLE) || !defined(ONLINE_TESTS_ENABLE)
+#error "havege_bench needs a build configured with --enable-diagnostic and online tests"
+#endif
+
+static H_UINT8 *sample;          /* injected input          */
+static size_t  sampleSz;         /* size of input in bytes  */
+static size_t  samplePos;        /* next byte to inject     */
+static double  injected;         /* bytes injected          */
+
+static const char *timers[TIME_SLOTS] = {"test0", "fips140", "test5", "test6a", "aisSeq", "test8"};
+
+/**
+ * Injection call-back, the sample is used as a circular buffer
+ */
+static int inject(volatile H_UINT *pData, H_UINT szData)
+{
+  H_UINT8 *dst = (H_UINT8 *)pData;
+  size_t n = szData * sizeof(H_UINT), k;
+
+  injected += n;
+  while(n>0) {
+    k = sampleSz - samplePos;
+    if (k > n)
+      k = n;
+    memcpy(dst, sample + samplePos, k);
+    dst += k;
+    n -= k;
+    samplePos = (samplePos + k) % sampleSz;
+    }
+  return 0;
+}
+/**
+ * Wall clock in seconds
+ */
+static double wall(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+/**
+ * Run a configuration, prod selects the timers for the tot or continuous tests
+ */
+static int bench(const char *title, char *spec, H_UINT prod, double mb)
+{
+  H_PARAMS params = {0};
+  H_PTR h;
+  procShared *tps;
+  onlineTests *olt;
+  double t, total, tested, sum = 0.0, out = 0.0;
+  int i, rc = 0;
+
+  params.options   = H_DEBUG_TEST_IN;
+  params.injection = inject;
+  params.testSpec  = spec;
+  samplePos = 0;
+  injected = 0.0;
+  t = wall();
+  h = havege_create(&params);
+  if (NULL==h || H_NOERR != h->error) {
+    fprintf(stderr, "ERROR: havege_create %s has returned %d\n", spec, NULL==h? H_NOHANDLE : h->error);
+    if (NULL!=h)
+      havege_destroy(h);
+    return 1;
+    }
+  if (havege_run(h))
+    rc = h->error;
+  while(0==rc && out < mb * 1024.0 * 1024.0) {
+    if (havege_rng(h, h->io_buf, h->i_readSz/sizeof(H_UINT)) <= 0)
+      rc = h->error;
+    out += h->i_readSz;
+    }
+  t = wall() - t;
+  tps = (procShared *)h->testData;
+  olt = NULL==h->collector? NULL : TESTS_CONTEXT(((H_COLLECT *)h->collector));
+  tested = NULL==olt? 0.0 : olt->szTotal / (8.0 * 1024.0 * 1024.0);
+  printf("%s (%s): %.1f MB injected, %.1f MB tested in %.3f s, %.2f MB/s%s\n", title, spec,
+    injected / (1024.0 * 1024.0), tested, t, tested / t, rc? " (tests failed)" : "");
+  for(i=0;i<TIME_SLOTS;i++)
+    sum += tps->cpuTime[prod][i];
+  for(i=0;i<TIME_SLOTS;i++) {
+    total = tps->cpuTime[prod][i];
+    printf("  %-8s %9.3f ms %6.1f%%\n", timers[i], 1000.0 * total, sum>0.0? 100.0 * total / sum : 0.0);
+    }
+  printf("  %-8s %9.3f ms, tests %.2f MB/s\n", "total", 1000.0 * sum, sum>0.0? tested / sum : 0.0);
+  havege_destroy(h);
+  return rc;
+}
+
+int main(int argc, char **argv) {
+  char *tot = "ta8b", *cont = "ca8b";
+  double mb = 64.0;
+  FILE *f;
+  int c;
+
+  while((c = getopt(argc, argv, "n:t:c:")) != -1) {
+    switch(c) {
+      case 'n':   mb = atof(optarg);   break;
+      case 't':   tot = optarg;        break;
+      case 'c':   cont = optarg;       break;
+      default:
+        fprintf(stderr, "usage: %s [-n MB output] [-t tot spec] [-c continuous spec] file\n", argv[0]);
+        return 1;
+      }
+    }
+  if (optind >= argc || NULL==(f = fopen(argv[optind], "rb"))) {
+    fprintf(stderr, "ERROR: no input file\n");
+    return 1;
+    }
+  fseek(f, 0, SEEK_END);
+  sampleSz = ftell(f);
+  rewind(f);
+  sampleSz -= sampleSz % sizeof(H_UINT);
+  if (0==sampleSz || NULL==(sample = malloc(sampleSz)) || fread(sample, 1, sampleSz, f) != sampleSz) {
+    fprintf(stderr, "ERROR: unable to read %s\n", argv[optind]);
+    return 1;
+    }
+  fclose(f);
+  fprintf(stderr, "library version is %s, input %lu bytes\n", havege_version(NULL), (unsigned long)sampleSz);
+  c  = bench("tot", tot, 0, 0.0);
+  c |= bench("continuous", cont, 1, mb);
+  free(sample);
+  return c? 1 : 0;
+}
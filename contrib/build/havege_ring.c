@@ -0,0 +1,60 @@
+/*
+Shared memory ring client - reads from the ring offered by a haveged EGD service
+and writes the output to stdout, reporting throughput to stderr.
+
+gcc -o havege_ring -DUSE_SOURCE -I../../src -Wall havege_ring.c ../../src/.libs/libhavege.a
+haveged -F -e /tmp/egd.sock -R 4096 &
+./havege_ring -n 256 /tmp/egd.sock > /dev/null
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#ifdef USE_SOURCE
+#include "havegering.h"
+#else
+#include <haveged/havegering.h>
+#endif
+
+int main(int argc, char **argv) {
+  H_RING_CLIENT r;
+  static char buf[65536];
+  double mb = 64.0, total = 0.0, t;
+  size_t sz = sizeof(buf);
+  struct timeval tv;
+  int c, n;
+
+  while((c = getopt(argc, argv, "n:b:")) != -1) {
+    switch(c) {
+      case 'n':   mb = atof(optarg);   break;
+      case 'b':   sz = atoi(optarg);   break;
+      default:
+        fprintf(stderr, "usage: %s [-n MB] [-b read size] socket\n", argv[0]);
+        return 1;
+      }
+    }
+  if (optind >= argc || sz < 1 || sz > sizeof(buf)) {
+    fprintf(stderr, "usage: %s [-n MB] [-b read size] socket\n", argv[0]);
+    return 1;
+    }
+  if (NULL == (r = havege_ring_open(argv[optind]))) {
+    perror("havege_ring_open");
+    return 1;
+    }
+  gettimeofday(&tv, NULL);
+  t = tv.tv_sec + tv.tv_usec * 1e-6;
+  while(total < mb * 1024.0 * 1024.0) {
+    if ((n = havege_ring_read(r, buf, sz, 1)) <= 0)
+      break;
+    if (fwrite(buf, 1, n, stdout) != (size_t)n)
+      break;
+    total += n;
+    }
+  gettimeofday(&tv, NULL);
+  t = tv.tv_sec + tv.tv_usec * 1e-6 - t;
+  fprintf(stderr, "%.1f MB in %.3f s, %.1f MB/s\n", total / (1024.0 * 1024.0), t, total / (1024.0 * 1024.0 * t));
+  havege_ring_close(r);
+  return 0;
+}
@@ -1,7 +1,63 @@
 #include <sys/types.h> 
 #include <unistd.h> 
 #include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "haveged.h"
+
+/*
+ * Warm restart state handed to every haveged started (-H). It outlives each
+ * daemon so a restarted one reuses the tuning and injects the reserve of tested
+ * output left by the last one while its own collector warms up.
+ */
+static H_HANDOFF *handoff_create(int *fd)
+{
+H_HANDOFF *s;
+
+*fd = -1;
+#ifdef SYS_memfd_create
+*fd = syscall(SYS_memfd_create, "haveged-handoff", 0);
+#endif
+if (*fd < 0) {
+  *fd = open("/dev/CB_RunHaveged.state", O_CREAT | O_EXCL | O_RDWR, 0600);
+  unlink("/dev/CB_RunHaveged.state");
+}
+if (*fd < 0 || ftruncate(*fd, sizeof(H_HANDOFF)) < 0) return NULL;
+s = mmap(NULL, sizeof(H_HANDOFF), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+if (s == MAP_FAILED) return NULL;
+s->version = HANDOFF_VERSION;
+s->magic = HANDOFF_MAGIC;
+return s;
+}
+
+static double now(void)
+{
+struct timeval tv;
+
+gettimeofday(&tv, NULL);
+return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* Restart timing, one "name value" per line as on the haveged control socket */
+static void handoff_stats(H_HANDOFF *s, int delay)
+{
+FILE *f = fopen("/dev/CB_RunHaveged.stats.tmp", "w");
+
+if (f == NULL) return;
+fprintf(f, "restarts %u\nlast_uptime %.1f\nlast_exit %d\nlast_signal %d\nrestart_delay %d\n",
+  s->restarts, s->last_uptime,
+  WIFEXITED(s->last_status) ? WEXITSTATUS(s->last_status) : -1,
+  WIFSIGNALED(s->last_status) ? WTERMSIG(s->last_status) : 0, delay);
+fprintf(f, "resume_ms %.1f\nwarm_ms %.1f\nresumed %u\nreserve %u\n",
+  s->resume_ms, s->warm_ms, s->resumed, s->held);
+fclose(f);
+rename("/dev/CB_RunHaveged.stats.tmp", "/dev/CB_RunHaveged.stats");
+}
 
 int main(int argc,char *argv[]) 
 {
@@ -22,14 +78,17 @@ if ( rc == -1 ) {
 }
  
 pid_t pid; 
-int fd[2];
+int fd[2], hfd, status;
+char hfd_arg[16];
+H_HANDOFF *handoff = handoff_create(&hfd);
 
 if (pipe(fd) < 0) return 1;
 
 //char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", "-o", "tbca8wbw", NULL}; 
 //char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", "-o", "tba8cba8", NULL}; 
 //char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", "-o", "ta8bcb", NULL}; 
-char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", "-o", "tbcb", NULL}; 
+snprintf(hfd_arg, sizeof(hfd_arg), "%d", hfd);
+char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", "-o", "tbcb", handoff ? "-H" : NULL, hfd_arg, NULL}; 
 //char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", "-o", "ta8wbwcbw", NULL}; 
 //char *const parmList[] = {"/data/data/ch.waut/files/bin/haveged", "-F", NULL}; 
 char *const envParms[2] = {"", NULL};
@@ -37,6 +96,10 @@ int i=1;
 loop:
 if ( i >=16 ) return 1; 
 i++;
+if (handoff) {
+  handoff->restarts++;
+  handoff->last_start = now();
+}
 if ((pid = fork()) ==-1) 
   perror("fork error"); 
 else if (pid == 0) 
@@ -46,6 +109,14 @@ else if (pid == 0)
   execve("/data/data/ch.waut/files/bin/haveged", parmList, envParms); 
   printf("Return not expected. Must be an execve error"); 
  }
- else { wait(NULL); sleep(i);goto loop; }
+ else {
+  waitpid(pid, &status, 0);
+  if (handoff) {
+    handoff->last_status = status;
+    handoff->last_uptime = now() - handoff->last_start;
+    handoff_stats(handoff, i);
+  }
+  sleep(i);goto loop;
+ }
 }
 
@@ -23,12 +23,18 @@
  * either a single collector in the calling process or an interface to
  * multiple collector processes (experimental).
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                 /* SCHED_IDLE */
+#endif
 #include "config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include "havegetest.h"
 #include "havegetune.h"
 /**
@@ -40,11 +46,9 @@
 #define  INTERFACE_DISABLED() strcmp(PACKAGE_VERSION,HAVEGE_PREP_VERSION)
 
 #if  NUMBER_CORES>1
-#include <errno.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <semaphore.h>
-#include <sched.h>
 /**
  * Collection thread directory
  */
@@ -55,6 +59,11 @@ typedef struct {
    H_UINT   last;       /* last output             */
    H_UINT   *out;       /* buffer pointer          */
    H_UINT   fatal;      /* fatal error in last     */
+   H_UINT   schedSeq;   /* bumped by havege_sched  */
+   H_UINT   schedIdle;  /* SCHED_IDLE requested    */
+   int      schedNice;  /* nice otherwise          */
+   double   mcv;        /* last collector estimate */
+   double   collision;  /* last collector estimate */
    sem_t    flags[1];   /* thread signals          */
 } H_THREAD;
 /**
@@ -65,6 +74,7 @@ static void havege_ipc(H_PTR h_ptr, H_UINT n, H_UINT sz);
 static int  havege_rngChild(H_PTR h_ptr, H_UINT cNumber);
 static void havege_unipc(H_PTR h_ptr);
 #endif
+static int  havege_schedSelf(H_UINT idle, int nice);
 /**
  * Main allocation
  */
@@ -75,7 +85,7 @@ typedef struct {
    procShared        std;        /* Shared test data        */
 } H_SETUP;
 
-static int    testsConfigure(H_UINT *tot, H_UINT *run, char *options);
+static int    testsConfigure(H_UINT *tot, H_UINT *run, H_UINT *budget, char *options);
 static void   testsStatus(procShared *tps, char *tot, char *prod);
 
 static void   testReport(H_COLLECT * h_ctxt, H_UINT action, H_UINT prod, H_UINT state, H_UINT ct);
@@ -136,14 +146,19 @@ H_PTR havege_create(             /* RETURN: app state    */
    {
       static const H_UINT tests[5]  = {B_RUN, A_RUN};
 
-      H_UINT tot=0,run=0;
+      H_UINT tot=0,run=0,budget=0;
       H_UINT i, j;
 
       procShared  *tps = (procShared *)&anchor->std;
-      if (testsConfigure(&tot, &run, params->testSpec)) {
+      if (testsConfigure(&tot, &run, &budget, params->testSpec)) {
          h->error = H_NOTESTSPEC;
          return h;
          }
+      tps->budget = budget;
+      if (0!=(run & H_RUN)) {
+         tps->testsUsed |= H_RUN;
+         tps->health = run & (H_RUN|H_OPTIONS);
+         }
       for(i=j=0;i<2;i++)
          if (0!=(tot & tests[i])) {
             tps->testsUsed |= tests[i];
@@ -233,11 +248,16 @@ int havege_rng(            /* RETURN: number words read     */
    else if (H_NOERR != t->fatal)
       h->error = t->fatal;
 #else
-   H_UINT i;
+   H_COLLECT   *c = (H_COLLECT *)h->collector;
+   H_UINT      i;
 
+   if (0 != c->havege_schedSet)
+      (void)havege_schedSelf(c->havege_schedIdle, c->havege_schedNice);
    for(i=0;i<sz;i++)
-      buffer[i] = havege_ndread((H_COLLECT *)h->collector);
-   h->error = ((H_COLLECT *)h->collector)->havege_err;
+      buffer[i] = havege_ndread(c);
+   if (0 != c->havege_schedSet)
+      (void)havege_schedSelf(0, c->havege_schedBase);
+   h->error = c->havege_err;
 #endif
    return h->error==(H_UINT)H_NOERR? sz : -1;
 }
@@ -284,9 +304,23 @@ void havege_status(        /* RETURN: none     */
       h_sts->tot_tests      = (0 != ps)? ps->totText :"";
       h_sts->prod_tests     = (0 != ps)? ps->prodText :"";
       if (0 != ps) {
-         memcpy(h_sts->n_tests, ps->meters, (H_OLT_PROD_B_P+1) * sizeof(H_UINT));
+         memcpy(h_sts->n_tests, ps->meters, (H_OLT_PROD_H_P+1) * sizeof(H_UINT));
          h_sts->last_test8     = ps->lastCoron;
+         h_sts->coverage       = (0==ps->coverage[0])? 0.0 :
+            (double)ps->coverage[0] / ((double)ps->coverage[0] + ps->coverage[1]);
+         }
+      h_sts->mcv_entropy = h_sts->collision_entropy = 0.0;
+#if NUMBER_CORES>1
+      if (0 != h_ptr->threads) {
+         H_THREAD *t = (H_THREAD *)h_ptr->threads;
+
+         h_sts->mcv_entropy       = t->mcv;
+         h_sts->collision_entropy = t->collision;
          }
+      else
+#endif
+      if (0 != h_ptr->collector)
+         havege_ndestimate((H_COLLECT *)h_ptr->collector, &h_sts->mcv_entropy, &h_sts->collision_entropy);
       }
 }
 /**
@@ -343,9 +377,16 @@ int  havege_status_dump(   /* RETURN: output length   */
                      n += snprintf(buf+n, len-n, "A:%d/%d ", status.n_tests[ H_OLT_PROD_A_P], m);
                   if ((m = status.n_tests[ H_OLT_PROD_B_P] + status.n_tests[ H_OLT_PROD_B_F])>0)
                      n += snprintf(buf+n, len, "B:%d/%d ", status.n_tests[ H_OLT_PROD_B_P], m);
+                  if ((m = status.n_tests[ H_OLT_PROD_H_P] + status.n_tests[ H_OLT_PROD_H_F])>0)
+                     n += snprintf(buf+n, len-n, "H:%d/%d ", status.n_tests[ H_OLT_PROD_H_P], m);
+                  if (0!=strchr(status.prod_tests, 'S'))
+                     n += snprintf(buf+n, len-n, "coverage %.3g ", status.coverage);
                   }
                if (n>0)
                   n += snprintf(buf+n, len-n, " last entropy estimate %g", status.last_test8);
+               if (status.mcv_entropy > 0.0)
+                  n += snprintf(buf+n, len-n, "%stimer min-entropy mcv: %.3g collision: %.3g",
+                     n>0? "; " : "", status.mcv_entropy, status.collision_entropy);
             }
             break;
          case H_SD_TOPIC_SUM:
@@ -371,6 +412,104 @@ int  havege_status_dump(   /* RETURN: output length   */
       }
    return n;
 }
+/**
+ * Change the diagnostic options
+ */
+void havege_options(       /* RETURN: nothing         */
+  H_PTR h_ptr,             /* IN-OUT: app state       */
+  H_UINT options)          /* IN: new options         */
+{
+   h_ptr->havege_opts = (h_ptr->havege_opts & ~0xff) | (options & 0xff);
+#ifdef ONLINE_TESTS_ENABLE
+   if (0 != h_ptr->testData) {
+      procShared *tps = (procShared *)(h_ptr->testData);
+
+      tps->options = (tps->options & ~0xff) | (options & 0xff);
+      }
+#endif
+}
+/**
+ * Change the scheduling class of the collectors. A single collector runs in the
+ * calling thread, collectors in other tasks pick up the change before their next
+ * fill.
+ */
+int havege_sched(          /* RETURN: NZ on failure   */
+  H_PTR h_ptr,             /* IN-OUT: app state       */
+  H_UINT idle,             /* IN: NZ for SCHED_IDLE   */
+  int nice)                /* IN: nice value if not   */
+{
+#if NUMBER_CORES>1
+   H_THREAD *t = (H_THREAD *) h_ptr->threads;
+
+   if (0 == t)
+      return 1;
+   t->schedIdle = idle;
+   t->schedNice = nice;
+   __sync_fetch_and_add(&t->schedSeq, 1);
+#else
+   H_COLLECT *c = (H_COLLECT *) h_ptr->collector;
+   int       base;
+
+   if (0 == c)
+      return 1;
+   if (0 == c->havege_schedSet) {
+      errno = 0;
+      base = getpriority(PRIO_PROCESS, 0);
+      c->havege_schedBase = 0 == errno? base : 0;
+      c->havege_schedSet  = 1;
+      }
+   c->havege_schedIdle = idle;
+   c->havege_schedNice = nice;
+#endif
+   return 0;
+}
+/**
+ * Change the continuous tests. Collectors in other tasks have their own copy of
+ * the test setup, so only a single collector in this task can be changed.
+ */
+int havege_tests_config(   /* RETURN: H_ERR status    */
+  H_PTR h_ptr,             /* IN-OUT: app state       */
+  char *spec)              /* IN: test spec           */
+{
+#ifdef ONLINE_TESTS_ENABLE
+   static const H_UINT tests[2]  = {B_RUN, A_RUN};
+
+   procShared  *tps = (procShared *)(h_ptr->testData);
+   H_COLLECT   *rdr = (H_COLLECT *)(h_ptr->collector);
+   onlineTests *context;
+   H_UINT      tot=0, run=0, budget=0, i, j;
+
+   if (0 == tps || 0 == rdr || 0 != h_ptr->threads || 0 == spec
+      || testsConfigure(&tot, &run, &budget, spec))
+      return H_NOTESTSPEC;
+   if (0 != (run & (A_RUN|B_RUN|H_RUN) & ~tps->testsUsed))
+      return H_NOTESTSPEC;
+   context = (onlineTests *) rdr->havege_tests;
+   if (0 != context->result
+      || (0 != context->pA && 0 != context->pA->procRetry)
+      || (0 != context->pB && 0 != context->pB->procRetry))
+      return H_NOTESTSPEC;
+   memset(tps->runTests, 0, sizeof(tps->runTests));
+   for(i=j=0;i<2;i++)
+      if (0!=(run & tests[i])) {
+         tps->runTests[j].action  = tests[i];
+         tps->runTests[j++].options = run;
+         }
+   tps->health = (0!=(run & H_RUN))? run & (H_RUN|H_OPTIONS) : 0;
+   tps->budget = budget;
+   context->runIdx = context->szCarry = context->skip = context->wFills = 0;
+   context->held = context->freed = 0;
+   if (0 != context->pA)
+      context->pA->procState = TEST_INIT;
+   if (0 != context->pB)
+      context->pB->procState = TEST_INIT;
+   testsStatus(tps, tps->totText, tps->prodText);
+   return H_NOERR;
+#else
+   (void)h_ptr;(void)spec;
+   return H_NOTESTSPEC;
+#endif
+}
 /**
  * Return-check library prep version. Calling havege_version() with a NULL version
  * returns the definition of HAVEGE_PREP_VERSION used to build the library. Calling
@@ -412,6 +551,27 @@ static void havege_mute(   /* RETURN: none            */
 {
    ;
 }
+/**
+ * Set the scheduling class of the calling task
+ */
+static int havege_schedSelf(  /* RETURN: NZ on failure   */
+   H_UINT idle,               /* IN: NZ for SCHED_IDLE   */
+   int nice)                  /* IN: nice value if not   */
+{
+   struct sched_param sp;
+
+   memset(&sp, 0, sizeof(sp));
+#ifdef SCHED_IDLE
+   if (0 != sched_setscheduler(0, idle? SCHED_IDLE : SCHED_OTHER, &sp))
+      return 1;
+   if (0 != idle)
+      return 0;
+#else
+   if (0 != idle)
+      nice = 19;
+#endif
+   return 0 != setpriority(PRIO_PROCESS, 0, nice);
+}
 #if NUMBER_CORES > 1
 /**
  * Cleanup collector(s). In a multi-collector environment, need to kill
@@ -492,7 +652,7 @@ static int havege_rngChild(/* RETURN: none         */
 {
    H_COLLECT   *h_ctxt = 0;
    H_THREAD    *thds = (H_THREAD *) h_ptr->threads;
-   H_UINT      cNext, i, r;
+   H_UINT      cNext, i, r, seq;
    int         pid;
 
    switch(pid=fork()) {
@@ -500,6 +660,7 @@ static int havege_rngChild(/* RETURN: none         */
          h_ctxt = havege_ndcreate(h_ptr, cNumber);
          if (NULL != h_ctxt) {
             cNext = (cNumber + 1) % h_ptr->n_cores;
+            seq   = 0;                     /* havege_sched() may precede us  */
             while(1) {
                if (0!=sem_wait(&thds->flags[cNumber])) {
                   thds->fatal = H_NOWAIT;
@@ -509,12 +670,17 @@ static int havege_rngChild(/* RETURN: none         */
                   havege_nddestroy(h_ctxt);
                   exit(0);
                   }
+               if (seq != thds->schedSeq) {
+                  seq = thds->schedSeq;
+                  (void)havege_schedSelf(thds->schedIdle, thds->schedNice);
+                  }
                thds->last = cNumber;
                r = h_ctxt->havege_szFill - h_ctxt->havege_nptr;
                if (thds->count < r)
                   r = thds->count; 
                for(i=0;i<r;i++)
                   thds->out[i] = havege_ndread(h_ctxt);
+               havege_ndestimate(h_ctxt, &thds->mcv, &thds->collision);
                thds->fatal = h_ctxt->havege_err;
                if (0==(thds->count -= i)) {
                   if (0!=sem_post(&thds->flags[h_ptr->n_cores])) {
@@ -560,11 +726,14 @@ static void havege_unipc(  /* RETURN: none         */
 #ifdef ONLINE_TESTS_ENABLE
 /**
  * Interpret options string as settings. The option string consists of terms
- * like "[t|c][a[1-8][w]|b[w]]". 
+ * like "[t|c][a[1-8][w]|b[w]|h[w]|s<n>]". The h and s<n> terms are only valid
+ * for the continuous tests. h runs the health tests on every fill and s<n>
+ * limits test time to n percent of collection time.
  */
 static int testsConfigure( /* RETURN: non-zero on error  */
    H_UINT *tot,            /* OUT: tot test options      */
    H_UINT *run,            /* OUT: run test options      */
+   H_UINT *budget,         /* OUT: cont test cpu share   */
    char *options)          /* IN: option string          */
 {
    H_UINT section=0;
@@ -610,6 +779,23 @@ static int testsConfigure( /* RETURN: non-zero on error  */
                *tot |= c;
             else *run |= c;
             break;
+         case 'H': case 'h':
+            if (section!='c') return 1;
+            c = H_RUN;
+            if (*options=='W' || *options=='w') {
+               c |= H_WARN;
+               options++;
+               }
+            *run |= c;
+            break;
+         case 'S': case 's':
+            if (section!='c') return 1;
+            c = atoi(options);
+            if (c < 1 || c > 99) return 1;
+            while(isdigit(*options))
+               options++;
+            *budget = c;
+            break;
          default:
             return 1;
          }
@@ -617,7 +803,8 @@ static int testsConfigure( /* RETURN: non-zero on error  */
    return 0;
 }
 /**
- * Show test setup. Output strings are [A[N]][B]..
+ * Show test setup. Output strings are [A[N]][B].. with H and S<n> appended to
+ * the production tests if health tests or sampling are configured.
  */
 static void testsStatus(    /* RETURN: test config     */
    procShared  *tps,        /* IN: shared data         */
@@ -651,13 +838,22 @@ static void testsStatus(    /* RETURN: test config     */
          *dst = 0;
          }
       }
+   dst = prod + strlen(prod);
+   if (0!=tps->health) {
+      *dst++ = 'H';
+      if (0 != (tps->health & H_WARN))
+         *dst++ = 'w';
+      *dst = 0;
+      }
+   if (0!=tps->budget)
+      sprintf(dst, "S%d", tps->budget);
 }
 /**
  * Reporting unit for tests
  */
 static void testReport(
    H_COLLECT * h_ctxt,     /* IN-OUT: collector context     */
-   H_UINT action,          /* IN: A_RUN or B_RUN            */
+   H_UINT action,          /* IN: A_RUN, B_RUN, or H_RUN    */
    H_UINT prod,            /* IN: 0==tot, else continuous   */
    H_UINT state,           /* IN: state variable            */
    H_UINT ct)              /* IN: bytes consumed            */
@@ -666,6 +862,14 @@ static void testReport(
    onlineTests *context = (onlineTests *) h_ctxt->havege_tests;
    char        *result;
    
+   if (action==H_RUN) {
+      h_ptr->print_msg("SP800-90B health tests: %s%s%s fill %d\n",
+         state==TEST_IGNORE? "warning" : "failure",
+         0!=(ct & 1)? " repetition count" : "",
+         0!=(ct & 2)? " adaptive proportion" : "",
+         h_ptr->n_fills);
+      return;
+      }
    switch(state) {
       case TEST_DONE:   result = "success";           break;
       case TEST_RETRY:  result = "retry";             break;
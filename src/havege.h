@@ -85,8 +85,10 @@ typedef int (*pRawIn)(volatile H_UINT *pData, H_UINT szData);
  *    otherwise defined)
  * 4) null callback values suppress the function.
  * 5) sysFs default is '/sys', procFs default is '/proc'.
- * 6) testSpec same as haveged option "[t<x>][c<x>] x=[a[n][w]][b[w]]". If
- *    not specified (NULL) the default is "ta8b" - i.e. run the tot tests
+ * 6) testSpec same as haveged option "[t<x>][c<x>[h[w]][s<n>]] x=[a[n][w]][b[w]]". If
+ *    not specified (NULL) the default is "ta8b" - i.e. run the tot tests. The
+ *    s<n> term samples the continuous tests to use at most n% of collection time,
+ *    the h term runs SP 800-90B health tests on every continuous fill
  */
 typedef struct {
    H_UINT      ioSz;                      /* size of write buffer          */
@@ -170,7 +172,9 @@ typedef enum {
    H_OLT_PROD_A_F,      /* prod Procedure A failed  */
    H_OLT_PROD_A_P,      /* prod Procedure A passed  */
    H_OLT_PROD_B_F,      /* prod Procedure B failed  */
-   H_OLT_PROD_B_P       /* prod Procedure B passed  */
+   H_OLT_PROD_B_P,      /* prod Procedure B passed  */
+   H_OLT_PROD_H_F,      /* prod health test failed  */
+   H_OLT_PROD_H_P       /* prod health test passed  */
 } H_OLT_METERS;
 /**
  * Structure used to query RNG anchor settings for information not exposed by
@@ -184,8 +188,8 @@ typedef enum {
  *
  *    1) Build: package version of source
  *    2) Build options: compiler version followed by build configuration encoded
- *       as string of: [C][I][M][T][V] where  C=clock_gettime, I=tune with cpuid,
- *       M=multi-core, T=online-test, V=tune with vfs
+ *       as string of: [C][E][I][M][T][V] where  C=clock_gettime, E=estimates,
+ *       I=tune with cpuid, M=multi-core, T=online-test, V=tune with vfs
  *    3) Tuning source lists: D=default, P=parameter, C=cpuid present,
  *          H=hyperthreading, A=AMD cpuid, A5=AMD fn5, A6=AMD fn6, A8=AMD fn8
  *          L2=Intel has leaf2, L4=Intel has leaf4, B=Intel leaf b,
@@ -194,8 +198,12 @@ typedef enum {
  *          VO=/sys/devices/system/cpu/online, VI=/proc/cpuinfo
  *          VC=/sys/devices/system/cpu
  *    4) test spec [A[1..8]][B], see H_PARAMS above.
- *    5) zero unless tests are enabled
+ *    5) zero unless tests are enabled, health tests count fills
  *    6) Last Coron's entropy estimate from Procedure B, test 8
+ *    7) Fraction of continuous test fills tested, less than 1 only if sampled
+ *    8) Streaming estimates in bits per timer delta low byte, 0-8, over recent
+ *       fills. Multi-core builds report the collector that ran last. Zero before
+ *       the first fill and unless built with --enable-estimate or diagnostics.
  */
 typedef struct h_status {
    const char    *version;                   /* Package version [1]             */
@@ -208,8 +216,11 @@ typedef struct h_status {
    const char    *prod_tests;                /* prod test spec [4]              */
    H_UINT        i_cache;                    /* size of L1 instruction cache KB */
    H_UINT        d_cache;                    /* size of L1 data cache KB        */
-   H_UINT        n_tests[H_OLT_PROD_B_P+1];  /* test statistics [5]             */
+   H_UINT        n_tests[H_OLT_PROD_H_P+1];  /* test statistics [5]             */
    double        last_test8;                 /* last test8 result [6]           */
+   double        coverage;                   /* continuous test coverage [7]    */
+   double        mcv_entropy;                /* most common value estimate [8]  */
+   double        collision_entropy;          /* collision estimate [8]          */
 } *H_STATUS;
 /**
  * Standard presentation formats for havege_status_dump.
@@ -220,7 +231,7 @@ typedef enum {
    H_SD_TOPIC_TUNE,
 /* cpu: (%s); data: %dK (%s); inst: %dK (%s); idx: %d/%d; sz: %d/%d */
    H_SD_TOPIC_TEST,
-/* [tot tests (%s): A:%d/%d B: %d/%d;][continuous tests (%s): A:%d/%d B: %d/%d;][last entropy estimate %g] */
+/* [tot tests (%s): A:%d/%d B: %d/%d;][continuous tests (%s): A:%d/%d B: %d/%d;[H: %d/%d][coverage %g]][last entropy estimate %g][; timer min-entropy mcv: %.3g collision: %.3g] */
    H_SD_TOPIC_SUM,
 /* fills: %d, generated: %.4g %c bytes */
 } H_SD_TOPIC;
@@ -283,6 +294,32 @@ void        havege_status(H_PTR hptr, H_STATUS hsts);
  * Returns the number of bytes placed in buf.
  */
 int         havege_status_dump(H_PTR hptr, H_SD_TOPIC topic, char *buf, size_t len);
+/**
+ * Change the diagnostic options, the low byte of H_PARAMS::options, of an
+ * anchor. Collectors in other tasks keep the options they started with.
+ */
+void        havege_options(H_PTR hptr, H_UINT options);
+/**
+ * Change the scheduling class of the collectors: SCHED_IDLE if idle is non-zero,
+ * otherwise SCHED_OTHER at the given nice value. The calling thread keeps its
+ * class. Collectors in other tasks change before their next fill. Without threads
+ * the collector runs in havege_rng(), which takes the class for the read and
+ * restores the class and nice value the caller had at the first call.
+ *
+ * Returns non-zero if the anchor has no collector. Failures to change the class
+ * are not reported.
+ */
+int         havege_sched(H_PTR hptr, H_UINT idle, int nice);
+/**
+ * Change the continuous tests of a running single collector anchor. The spec
+ * uses the continuous group syntax of H_PARAMS::testSpec, any tot group is
+ * ignored. Only procedures set up by havege_create() may be used and the change
+ * is refused while a test failure or retry is pending. The new tests start with
+ * the next fill.
+ *
+ * Returns H_NOERR or H_NOTESTSPEC.
+ */
+int         havege_tests_config(H_PTR hptr, char *spec);
 /**
  * Return/check library prep version. Calling havege_version() with a NULL version
  * returns the definition of HAVEGE_PREP_VERSION used to build the library. Calling
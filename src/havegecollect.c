@@ -35,6 +35,14 @@
 #if defined(RAW_IN_ENABLE) || defined(RAW_OUT_ENABLE)
 #define  DIAGNOSTICS_ENABLE
 #endif
+/**
+ * Timer entropy estimates need the readings of the collection loop. Diagnostic
+ * builds keep every reading in the tics buffer, other builds store them only if
+ * configured with --enable-estimate since the store adds to the loop.
+ */
+#if defined(DIAGNOSTICS_ENABLE) || defined(ENTROPY_ESTIMATE_ENABLE)
+#define  ESTIMATES_ENABLE
+#endif
 /**
  * Option to use clockgettime() as timer source
  */
@@ -110,16 +118,23 @@ typedef enum {
 #else
 #define HTICK1          (h_ctxt->havege_tic)
 #define HTICK2          (h_ctxt->havege_tic)
+#ifdef ENTROPY_ESTIMATE_ENABLE
+#define SZ_TICK         TICK_RING
+#else
 #define SZ_TICK         0
 #endif
+#endif
 
 /**
- * If the injection diagnostic is enabled, use a wrapper for the timer source
+ * If the injection diagnostic is enabled, use a wrapper for the timer source.
+ * If only the estimates are enabled, each reading is also saved to a small ring.
  */
 #ifdef   RAW_IN_ENABLE
 static H_UINT havege_inject(H_COLLECT *h_ctxt, H_UINT x);
 
 #define  HARDCLOCKR(x)  x=havege_inject(h_ctxt, x)
+#elif defined(ENTROPY_ESTIMATE_ENABLE) && !defined(DIAGNOSTICS_ENABLE)
+#define  HARDCLOCKR(x)  {HARDCLOCK(x); h_ctxt->havege_tics[(i>>3) & (TICK_RING-1)] = x;}
 #else
 #define  HARDCLOCKR(x)  HARDCLOCK(x)
 #endif
@@ -134,6 +149,33 @@ inline static H_UINT ror32(const H_UINT value, const H_UINT shift) {
 }
 #define ROR32(value,shift) ror32(value, shift)
 #endif
+/**
+ * The estimators avoid a libm dependency with these minimal helpers
+ */
+static double havege_log2(double x)
+{
+   double   y = 0.0, z, z2, t;
+   H_UINT   i;
+
+   while(x >= 2.0) { x /= 2.0; y += 1.0; }
+   while(x < 1.0)  { x *= 2.0; y -= 1.0; }
+   z  = (x - 1.0) / (x + 1.0);                  /* ln x = 2 atanh(z) */
+   z2 = z * z;
+   for(i=1,t=z,x=0.0;i<40;i+=2,t*=z2)
+      x += t / i;
+   return y + 2.0 * x / 0.69314718055994530941;
+}
+static double havege_sqrt(double x)
+{
+   double   y = x > 1.0? x : 1.0;
+   H_UINT   i;
+
+   if (x <= 0.0)
+      return 0.0;
+   for(i=0;i<64;i++)
+      y = 0.5 * (y + x / y);
+   return y;
+}
 /**
  * Local prototypes
  */
@@ -146,6 +188,9 @@ static int havege_gather(H_COLLECT * h_ctxt) __attribute__((optimize(1)));
 #else
 static int  havege_gather(H_COLLECT * h_ctxt);
 #endif
+#ifdef ESTIMATES_ENABLE
+static void havege_ndentropy(H_COLLECT *h_ctxt);
+#endif
 static void havege_ndinit(H_PTR h_ptr, struct h_collect *h_ctxt);
 
 /**
@@ -242,6 +287,12 @@ void havege_nddestroy(        /* RETURN: none           */
          h_ctxt->havege_extra = 0;
          }
       if (h_ctxt->havege_tests!=0) {
+#ifdef ONLINE_TESTS_ENABLE
+         onlineTests *context = TESTS_CONTEXT(h_ctxt);
+
+         if (0!=context->hold)
+            free(context->hold);
+#endif
          free(h_ctxt->havege_tests);
          h_ctxt->havege_tests = 0;
          }
@@ -263,13 +314,27 @@ H_UINT havege_ndread(         /* RETURN: data value     */
 #ifdef ONLINE_TESTS_ENABLE
       {
          procShared *ps = (procShared *)(h_ptr->testData);
-         do {
-            (void) havege_gather(h_ctxt);
-            (void) ps->run(h_ctxt, 1);
-            } while(ps->discard(h_ctxt)>0);
+         H_UINT     t0, t1, t2;
+
+         if (0==ps->release(h_ctxt))               /* else a held fill passed       */
+            do {
+               HARDCLOCK(t0);
+               (void) havege_gather(h_ctxt);
+               HARDCLOCK(t1);
+               (void) ps->run(h_ctxt, 1);
+               HARDCLOCK(t2);
+               h_ctxt->havege_tCollect = t1 - t0;
+               h_ctxt->havege_tTest    = t2 - t1;
+#ifdef ESTIMATES_ENABLE
+               havege_ndentropy(h_ctxt);
+#endif
+               } while(ps->discard(h_ctxt)>0);
       }
 #else
       (void) havege_gather(h_ctxt);
+#ifdef ESTIMATES_ENABLE
+      havege_ndentropy(h_ctxt);
+#endif
 #endif
       h_ptr->n_fills += 1;
       if (0 != pm)
@@ -282,6 +347,38 @@ H_UINT havege_ndread(         /* RETURN: data value     */
 #endif
    return RESULT[h_ctxt->havege_nptr++];
 }
+/**
+ * Report the streaming min-entropy estimates, in bits per timer delta, from the
+ * histogram of delta low bytes. The most common value estimate is -log2 of the
+ * upper 99% confidence bound on the most frequent symbol as in SP 800-90B 6.3.1.
+ * The collision estimate is the Renyi order 2 entropy -log2(sum p^2), computed
+ * from the unbiased collision count, which bounds min-entropy from above. Both
+ * are zero until a full fill of deltas has been counted, and always zero unless
+ * the estimates are enabled.
+ */
+void havege_ndestimate(       /* RETURN: none                   */
+   H_COLLECT *h_ctxt,         /* IN: collector context          */
+   double *mcv,               /* OUT: most common value bits    */
+   double *collision)         /* OUT: collision entropy bits    */
+{
+   double   n = h_ctxt->havege_entN, p, q;
+   H_UINT   i, m;
+
+   *mcv = *collision = 0.0;
+   if (h_ctxt->havege_entN < TICK_RING)
+      return;
+   for(i=m=0,q=0.0;i<ENT_SYMBOLS;i++) {
+      p = h_ctxt->havege_entHist[i];
+      q += p * (p - 1.0);
+      if (h_ctxt->havege_entHist[i] > m)
+         m = h_ctxt->havege_entHist[i];
+      }
+   p = m / n;
+   p += 2.576 * havege_sqrt(p * (1.0 - p) / (n - 1.0));
+   *mcv = p < 1.0? -havege_log2(p) : 0.0;
+   q /= n * (n - 1.0);
+   *collision = q > 0.0? -havege_log2(q) : havege_log2(ENT_SYMBOLS);
+}
 /**
  * Setup haveged
  */
@@ -421,6 +518,45 @@ LOOP(0,0)
 loop_exit:
    return ANDPT==0? 0 : 1;
 }
+#ifdef ESTIMATES_ENABLE
+/**
+ * Fold the timer deltas saved by the last fill into the estimator histogram. Only
+ * the low byte of a delta is counted, the high bits being mostly constant. The
+ * histogram is halved when full so that the estimates track the recent behaviour
+ * of the noise source. Fills too small to cover the ring are not counted.
+ */
+static void havege_ndentropy(    /* RETURN: none                  */
+   H_COLLECT *h_ctxt)            /* IN: collector context         */
+{
+#ifdef DIAGNOSTICS_ENABLE
+   H_UINT   *t = h_ctxt->havege_tics + (h_ctxt->havege_szCollect>>3) - TICK_RING;
+   H_UINT   j = 0;
+
+#if defined(RAW_IN_ENABLE)
+   if (0 != (h_ctxt->havege_raw & H_DEBUG_TEST_IN))
+      return;
+#endif
+#else
+   H_UINT   *t = h_ctxt->havege_tics;
+   H_UINT   j = h_ctxt->havege_szCollect>>3;           /* oldest reading   */
+#endif
+   H_UINT   i, k, prev;
+
+   if ((h_ctxt->havege_szCollect>>3) < TICK_RING)
+      return;
+   prev = t[j & (TICK_RING-1)];
+   for(i=1;i<TICK_RING;i++) {
+      k = t[(j+i) & (TICK_RING-1)];
+      h_ctxt->havege_entHist[(k - prev) & (ENT_SYMBOLS-1)] += 1;
+      prev = k;
+      }
+   if ((h_ctxt->havege_entN += TICK_RING-1) >= ENT_WINDOW) {
+      for(i=k=0;i<ENT_SYMBOLS;i++)
+         k += (h_ctxt->havege_entHist[i] >>= 1);
+      h_ctxt->havege_entN = k;
+      }
+}
+#endif
 #ifdef   RAW_IN_ENABLE
 /**
  * Wrapper for noise injector. When input is injected, the hardclock
@@ -23,6 +23,12 @@
  ** Definitions needed to build haveged
  */
 #include "havege.h"
+/**
+ * Sizing of the streaming min-entropy estimators over the timer deltas
+ */
+#define TICK_RING       256            /* Timer readings kept per fill      */
+#define ENT_SYMBOLS     256            /* Alphabet: low byte of delta       */
+#define ENT_WINDOW      65536          /* Deltas counted before halving     */
 /**
  * The collection context
  */
@@ -45,6 +51,14 @@ typedef struct h_collect {
    H_UINT   havege_tic;                   /* Instance variable             */
    H_UINT  *havege_tics;                  /* loop timer noise buffer       */
    H_UINT   havege_err;                   /* H_ERR enum for status         */
+   H_UINT   havege_tCollect;              /* ticks used by last fill       */
+   H_UINT   havege_tTest;                 /* ticks used by last test run   */
+   H_UINT   havege_entN;                  /* timer deltas in histogram     */
+   H_UINT   havege_entHist[ENT_SYMBOLS];  /* timer delta low byte counts   */
+   H_UINT   havege_schedSet;              /* nz if havege_sched() called   */
+   H_UINT   havege_schedIdle;             /* SCHED_IDLE for reads          */
+   int      havege_schedNice;             /* nice for reads otherwise      */
+   int      havege_schedBase;             /* nice of the caller            */
    void    *havege_tests;                 /* opague test context           */
    void    *havege_extra;                 /* other allocations             */
    H_UINT   havege_bigarray[1];           /* collection buffer             */
@@ -214,5 +228,6 @@ H_COLLECT   *havege_ndcreate(H_PTR hptr, H_UINT nCollector);
 void        havege_nddestroy(H_COLLECT *rdr);
 H_UINT      havege_ndread(H_COLLECT *rdr);
 void        havege_ndsetup(H_PTR hptr);
+void        havege_ndestimate(H_COLLECT *rdr, double *mcv, double *collision);
 
 #endif
@@ -17,6 +17,9 @@
  ** You should have received a copy of the GNU General Public License
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                 /* pipe sizing */
+#endif
 #include "config.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -26,6 +29,7 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <time.h>
 
 #ifndef NO_DAEMON
 #include <unistd.h>
@@ -38,6 +42,19 @@
 #include <sys/stat.h>
 #include <poll.h>
 #include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#if NUMBER_CORES>1
+#include <pthread.h>
+#endif
 
 #ifndef NO_DAEMON
 
@@ -48,125 +65,39 @@ static void write_file( char file_name[], char value[] );
 static void read_file( char file_name[] );
 void read_char(void);
 int threshold=3968;
+static int batch = 0;               /* injection limit [bits], 0 for threshold */
 
 #ifdef __ANDROID__
 
+#include <limits.h>
 #include <linux/ioprio.h>
 #include <pthread.h>
-int sleeping=0;
+volatile int sleeping=0;
+
+static void governor_set(const char *governor);
+static void governor_topology(void);
+static void sysfs_forget(const char *pattern);
+static int  sysfs_info(char *out, int len);
+static int  sysfs_set(const char *path, const char *value);
+static void sysfs_stale(void);
+static void power_event(void);
 
 void governor_ondemand()
 {
 				  system("/system/bin/setprop debug.composition.type cpu");
 				  system("/system/bin/setprop persist.sys.composition.type cpu");
 						 
-				  write_file("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu1/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu2/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu4/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu5/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu6/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu7/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu8/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu9/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu10/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu11/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu12/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu13/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu14/cpufreq/scaling_governor","ondemand");
-				  write_file("/sys/devices/system/cpu/cpu15/cpufreq/scaling_governor","ondemand");
+				  governor_set("ondemand");
 }
 
 void governor_interactive()
 {
-			     write_file("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu1/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu2/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu4/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu5/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu6/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu7/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu8/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu9/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu10/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu11/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu12/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu13/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu14/cpufreq/scaling_governor","interactive");
-				 write_file("/sys/devices/system/cpu/cpu15/cpufreq/scaling_governor","interactive");
-	
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/above_hispeed_delay","20000");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/boost","0");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/boostpulse_duration","80000");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/boosttop_duration","80000");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/go_highspeed_load","99");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/go_maxspeed_load","99");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/input_dev_monitor","1");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/input_boost","1");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/io_is_busy","0");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/min_sample_time","80000");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/target_loads","90");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/target_load","90");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/sustain_load","90");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/timer_rate","20000");
-				 write_file("/sys/devices/system/cpu/cpufreq/interactive/timer_slack","80000");
+				 governor_set("interactive");
 
 //				 system("/system/bin/setprop debug.composition.type dyn");
 //				 system("/system/bin/setprop persist.sys.composition.type dyn");
 				 system("/system/bin/setprop debug.composition.type gpu");
 				 system("/system/bin/setprop persist.sys.composition.type gpu");
-
-int i = 0 ;
-char string1[80];
-	
-	for (i=0;i<=15;i++) {
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/above_hispeed_delay",i);
-				 write_file(string1,"20000");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/boost",i);
-				 write_file(string1,"0");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/boostpulse_duration",i);
-				 write_file(string1,"80000");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/boosttop_duration",i);
-				 write_file(string1,"80000");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/go_highspeed_load",i);
-				 write_file(string1,"99");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/go_maxspeed_load",i);
-				 write_file(string1,"99");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/input_dev_monitor",i);
-				 write_file(string1,"1");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/input_boost",i);
-				 write_file(string1,"1");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/io_is_busy",i);
-				 write_file(string1,"0");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/min_sample_time",i);
-				 write_file(string1,"80000");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/target_loads",i);
-				 write_file(string1,"90");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/target_load",i);
-				 write_file(string1,"90");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/sustain_load",i);
-				 write_file(string1,"90");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/timer_rate",i);
-				 write_file(string1,"20000");
-		
-				 sprintf(string1,"/sys/devices/system/cpu/cpu%d/cpufreq/interactive/timer_slack",i);
-				 write_file(string1,"80000");
-	}
 }
 
 void *fn_sleep (void *ret)
@@ -191,25 +122,26 @@ void *fn_sleep (void *ret)
 				read(fin,input,1);
 //				if ( buffer == 's' ) {
 			      sleeping=1;                       
+				  power_event();
 				  unlink("AWAKE");
 				  write_file("SLEEPING","1");
 //			  	 write_file("/proc/sys/vm/vfs_cache_pressure","1000");
-			  	 write_file("/proc/sys/vm/vfs_cache_pressure","999999999");
-			  	 write_file("/proc/sys/vm/vfs_cache_pressure","10");
+			  	 sysfs_set("/proc/sys/vm/vfs_cache_pressure","999999999");
+			  	 sysfs_set("/proc/sys/vm/vfs_cache_pressure","10");
 //			  	 write_file("/proc/sys/vm/vfs_cache_pressure","100");
-				 write_file("/proc/sys/vm/dirty_background_ratio","98");
-				  write_file("/proc/sys/vm/dirty_ratio","98");
+				 sysfs_set("/proc/sys/vm/dirty_background_ratio","98");
+				  sysfs_set("/proc/sys/vm/dirty_ratio","98");
 //				  write_file("/proc/sys/vm/dirty_bytes","10000");
 				 // write_file("/proc/sys/vm/dirty_background_bytes","100000");
-				  write_file("/proc/sys/vm/dirty_expire_centisecs","3000");
-				  write_file("/proc/sys/vm/dirty_writeback_centisecs","3000");
+				  sysfs_set("/proc/sys/vm/dirty_expire_centisecs","3000");
+				  sysfs_set("/proc/sys/vm/dirty_writeback_centisecs","3000");
 //				  write_file("/proc/sys/vm/overcommit_ratio","50");
-				  write_file("/proc/sys/vm/swappiness","2");
-				  write_file("/proc/sys/vm/swappiness","10");
+				  sysfs_set("/proc/sys/vm/swappiness","2");
+				  sysfs_set("/proc/sys/vm/swappiness","10");
 //				  write_file("/proc/sys/vm/overcommit_ratio","49");
 //				  write_file("/proc/sys/vm/overcommit_memory","1");					
-				  write_file("/proc/sys/net/ipv4/icmp_echo_ignore_all","1");
-				  write_file("/proc/sys/net/ipv4/tcp_timestamps","0");
+				  sysfs_set("/proc/sys/net/ipv4/icmp_echo_ignore_all","1");
+				  sysfs_set("/proc/sys/net/ipv4/tcp_timestamps","0");
 				  set_low_watermark(threshold); /* READ */
 				  set_watermark(threshold); /* WRITE */
 				  read_file("/proc/sys/kernel/random/entropy_avail");
@@ -239,6 +171,7 @@ void *fn_sleep (void *ret)
 				read(fout,input,1);
 
 		  		sleeping=0;
+				  power_event();
 				  unlink("SLEEPING");
 				  write_file("AWAKE","1");
 				 set_low_watermark(threshold); /* READ */
@@ -261,25 +194,25 @@ void *fn_sleep (void *ret)
 //				 set_watermark(320);				
 //				  write_file("/proc/sys/vm/drop_caches","1");
 //			  	 write_file("/proc/sys/vm/vfs_cache_pressure","1");
-			  	 write_file("/proc/sys/vm/vfs_cache_pressure","1000");
-			  	 write_file("/proc/sys/vm/vfs_cache_pressure","10");
-				 write_file("/proc/sys/vm/swappiness","2");
-				 write_file("/proc/sys/vm/swappiness","1");
+			  	 sysfs_set("/proc/sys/vm/vfs_cache_pressure","1000");
+			  	 sysfs_set("/proc/sys/vm/vfs_cache_pressure","10");
+				 sysfs_set("/proc/sys/vm/swappiness","2");
+				 sysfs_set("/proc/sys/vm/swappiness","1");
 //			  	 write_file("/proc/sys/vm/vfs_cache_pressure","5");
 //			  	 write_file("/proc/sys/vm/vfs_cache_pressure","1");
 //				 write_file("/proc/sys/vm/dirty_ratio","99");
 //				 write_file("/proc/sys/vm/dirty_expire_centisecs","1500");
 //				 write_file("/proc/sys/vm/dirty_background_ratio","99");
 //				  write_file("/proc/sys/vm/dirty_ratio","99");
-				  write_file("/proc/sys/vm/dirty_bytes","1048576");
-				  write_file("/proc/sys/vm/dirty_background_bytes","1048576");
-				  write_file("/proc/sys/vm/dirty_expire_centisecs","1000");
-				  write_file("/proc/sys/vm/dirty_writeback_centisecs","1000");
+				  sysfs_set("/proc/sys/vm/dirty_bytes","1048576");
+				  sysfs_set("/proc/sys/vm/dirty_background_bytes","1048576");
+				  sysfs_set("/proc/sys/vm/dirty_expire_centisecs","1000");
+				  sysfs_set("/proc/sys/vm/dirty_writeback_centisecs","1000");
 //				 write_file("/proc/sys/vm/overcommit_ratio","51");
 //				 write_file("/proc/sys/vm/overcommit_ratio","50");
 //				 write_file("/proc/sys/vm/overcommit_memory","1");					
-			  	 write_file("/proc/sys/net/ipv4/icmp_echo_ignore_all","1");
-			     write_file("/proc/sys/net/ipv4/tcp_timestamps","0");
+			  	 sysfs_set("/proc/sys/net/ipv4/icmp_echo_ignore_all","1");
+			     sysfs_set("/proc/sys/net/ipv4/tcp_timestamps","0");
 //			fclose(fp);
 			close(fout);
             }
@@ -300,6 +233,8 @@ void *fn_sleep (void *ret)
 #include <errno.h>
 #include "haveged.h"
 #include "havegecollect.h"
+#include "havegetune.h"
+#include "havegering.h"
 /**
  * stringize operators for maintainable text
  */
@@ -333,7 +268,21 @@ static struct pparams defaults = {
   .sample_in      = INPUT_DEFAULT,
   .sample_out     = OUTPUT_DEFAULT,
   .verbose        = 0,
-  .watermark      = "/proc/sys/kernel/random/write_wakeup_threshold"
+  .watermark      = "/proc/sys/kernel/random/write_wakeup_threshold",
+  .egd_path       = 0,
+  .egd_rate       = 0,
+  .ring_kb        = 0,
+  .out_bufs       = OUT_BUFS,
+  .out_kb         = OUT_KB,
+  .shards         = 0,
+  .shard_split    = 0,
+  .ctl_path       = 0,
+  .cfg_path       = 0,
+  .handoff_fd     = -1,
+  .sched_low      = 0,
+  .sched_nice     = 0,
+  .budget_pct     = 0.0,
+  .budget_secs    = BUDGET_WINDOW
   };
 struct pparams *params = &defaults;
 
@@ -348,12 +297,60 @@ static int injectFile(volatile H_UINT *pData, H_UINT szData);
  * havege instance used by application
  */
 static H_PTR handle = NULL;
+/**
+ * Shard writers started by run_shards
+ */
+static pid_t  shardPids[OUT_MAXSHARDS];
+static H_UINT shardCt = 0;
 /**
  * Local prototypes
  */
 #ifndef NO_DAEMON
 static H_UINT poolSize = 0;
+static H_DSTATS dstats;
+static H_FORECAST forecast;
+static H_HANDOFF *handoff = NULL;
+static double handoffStart;
+static pid_t resumePid = 0;
+static char testsSpec[CTL_LINESZ];
+static H_SCHED sched;
+static H_BUDGET *budget = NULL;
+static double budgetOwn = 0.0;
+#ifdef __ANDROID__
+static H_PARAMS *daemonCmd = NULL;
+static H_POWER power;
+static int powerFd = -1;
+static H_PARAMS powerCmd;
+static pthread_t powerThread;
+static H_PTR volatile powerReady = NULL;
+#endif
 
+static int  ctl_client(H_PTR h, struct pollfd *p, H_CTLCLIENT *c);
+static int  ctl_command(H_PTR h, char *line, char *out, int len);
+static int  ctl_listen(const char *path);
+static void daemon_forecast(int current, int level);
+static int  daemon_timeout(void);
+static void handoff_open(H_PARAMS *cmd);
+static void handoff_resume(void);
+static void handoff_warm(H_PTR h);
+#ifdef __ANDROID__
+static void governor_online(H_PTR h);
+static H_PTR power_ready(int poolsize);
+static void power_resume(int fd, int poolsize, H_UINT early);
+static void *power_start(void *arg);
+static H_PTR power_suspend(H_PTR h, int fd, int poolsize);
+static int  power_take(int nbytes);
+#endif
+static void budget_charge(void);
+static void budget_meter(H_UINT id, H_UINT event);
+static void budget_open(H_PARAMS *cmd);
+static void budget_refill(H_BUDGET *b, double now);
+static void daemon_reload(H_PTR h);
+static void daemon_info(H_PTR h);
+static double daemon_now(void);
+static void run_egd(H_PTR h);
+static void sched_govern(H_PTR h, int level);
+static int  egd_ring_send(int fd);
 static void daemonize(void);
 static int  get_poolsize(void);
 static void run_daemon(H_PTR handle);
@@ -363,10 +360,17 @@ static void set_watermark(int level);
 static void anchor_info(H_PTR h);
 static void error_exit(const char *format, ...);
 static int  get_runsize(unsigned int *bufct, unsigned int *bufrem, char *bp);
+static void out_close(H_OUTPUT *o);
+static H_UINT8 *out_get(H_OUTPUT *o);
+static void out_open(H_PTR h, H_OUTPUT *o);
+static void out_put(H_OUTPUT *o, size_t n);
+static int  out_write(int fd, H_UINT8 *p, size_t n);
 static char *ppSize(char *buffer, double sz);
 static void print_msg(const char *format, ...);
 
 static void run_app(H_PTR handle, H_UINT bufct, H_UINT bufres);
+static void run_shard(H_PARAMS *cmd, H_UINT id, unsigned long long offs, unsigned long long sz);
+static void run_shards(H_PARAMS *cmd, H_UINT bufct, H_UINT bufres);
 static void show_meterInfo(H_UINT id, H_UINT event);
 static void tidy_exit(int signum);
 static void usage(int db, int nopts, struct option *long_options, const char **cmds);
@@ -378,15 +382,24 @@ static void usage(int db, int nopts, struct option *long_options, const char **c
 int main(int argc, char **argv)
 {
    static const char* cmds[] = {
+      "a", "async",       "1", SETTINGR("Output buffers <n>[:<KB each>], default: ", OUT_BUFS) ":" STRZ(OUT_KB),
       "b", "buffer",      "1", SETTINGR("Buffer size [KW], default: ",COLLECT_BUFSIZE),
+      "B", "budget",      "1", "Cpu budget <% of a core>[:<window secs>], default window: " STRZ(BUDGET_WINDOW),
+      "C", "config",      "1", "Settings file <path> applied at start and on SIGHUP",
+      "c", "control",     "1", "Control socket <path> for live statistics and settings",
       "d", "data",        "1", SETTINGR("Data cache size [KB], with fallback to: ", GENERIC_DCACHE ),
+      "e", "egd",         "1", "Serve EGD socket <path>[:<KB/s per client>] instead of the pool",
       "i", "inst",        "1", SETTINGR("Instruction cache size [KB], with fallback to: ", GENERIC_ICACHE),
       "f", "file",        "1", "Sample output file,  default: '" OUTPUT_DEFAULT "', '-' for stdout",
       "F", "Foreground",  "0", "Run daemon in foreground",
+      "H", "handoff",     "1", "Warm restart state <fd> held by a supervisor",
       "r", "run",         "1", "0=daemon, 1=config info, >1=<r>KB sample",
       "n", "number",      "1", "Output size in [k|m|g|t] bytes, 0 = unlimited to stdout",
-      "o", "onlinetest",  "1", "[t<x>][c<x>] x=[a[n][w]][b[w]] 't'ot, 'c'ontinuous, default: ta8b",
+      "o", "onlinetest",  "1", "[t<x>][c<x>[h[w]][s<n>]] x=[a[n][w]][b[w]] 't'ot, 'c'ontinuous, 'h'ealth, 's'ample n%, default: ta8b",
       "p", "pidfile",     "1", "daemon pidfile, default: " PID_DEFAULT ,
+      "P", "priority",    "1", "Idle the collector at the threshold, normal below <bits>[:<nice>]",
+      "R", "ring",        "1", "Shared memory ring size [KB] offered on the EGD socket",
+      "S", "shards",      "1", "Generate output in <n>[:split] parallel shards, one collector each",
       "s", "source",      "1", "Injection source file, default: '" INPUT_DEFAULT "', '-' for stdin",
       "t", "threads",     "1", "Number of threads",
       "v", "verbose",     "1", "Verbose mask 0=none,1=summary,2=retries,4=timing,8=loop,16=code,32=test",
@@ -467,7 +480,8 @@ int main(int argc, char **argv)
             if (0 == (params->setup & MULTI_CORE))
                continue;
             break;
-         case 'p':   case 'w':  case 'F':
+         case 'p':   case 'w':  case 'F':   case 'e':   case 'R':   case 'c':   case 'C':   case 'H':
+         case 'P':   case 'B':
             if (0 !=(params->setup & RUN_AS_APP))
                continue;
             break;
@@ -489,14 +503,76 @@ int main(int argc, char **argv)
             params->setup |= RUN_IN_FG;
             params->foreground = 1;
             break;
+         case 'a':
+            {
+               char *kb = strchr(optarg, ':');
+
+               if (0 != kb) {
+                  *kb++ = 0;
+                  params->out_kb = ATOU(kb);
+                  }
+               params->out_bufs = ATOU(optarg);
+               if (params->out_bufs<1 || params->out_bufs>OUT_MAXBUFS || params->out_kb<4)
+                  error_exit("invalid output buffers %s", optarg);
+               if ((unsigned long long)params->out_bufs * params->out_kb > OUT_MAXMB * 1024ULL)
+                  error_exit("output buffers over %d MB", OUT_MAXMB);
+            }
+            break;
          case 'b':
             params->buffersz = ATOU(optarg) * 1024;
             if (params->buffersz<4)
                error_exit("invalid size %s", optarg);
             break;
+         case 'B':
+            {
+               char *w = strchr(optarg, ':');
+
+               if (0 != w) {
+                  *w++ = 0;
+                  params->budget_secs = ATOU(w);
+                  }
+               params->budget_pct = atof(optarg);
+               if (params->budget_pct<=0.0 || params->budget_pct>100.0 || params->budget_secs<1 || params->budget_secs>3600)
+                  error_exit("invalid budget %s", optarg);
+            }
+            break;
+         case 'c':
+            params->ctl_path = optarg;
+            break;
+         case 'C':
+            params->cfg_path = optarg;
+            break;
+         case 'H':
+            params->handoff_fd = atoi(optarg);
+            break;
+         case 'P':
+            {
+               char *nv = strchr(optarg, ':');
+
+               if (0 != nv) {
+                  *nv++ = 0;
+                  params->sched_nice = atoi(nv);
+                  }
+               params->sched_low = ATOU(optarg);
+               if (params->sched_low<1 || params->sched_nice<-20 || params->sched_nice>19)
+                  error_exit("invalid priority %s", optarg);
+            }
+            break;
          case 'd':
             params->d_cache = ATOU(optarg);
             break;
+         case 'e':
+            {
+               char *rate = strrchr(optarg, ':');
+
+               if (0 != rate && 0 != rate[1] && strspn(rate+1, "0123456789")==strlen(rate+1)) {
+                  *rate++ = 0;
+                  params->egd_rate = ATOU(rate) * 1024;
+                  }
+               params->egd_path = optarg;
+               params->setup |= USE_EGD;
+            }
+            break;
          case 'i':
             params->i_cache = ATOU(optarg);
             break;
@@ -518,11 +594,29 @@ int main(int argc, char **argv)
          case 'p':
             params->pid_file = optarg;
             break;
+         case 'R':
+            params->ring_kb = ATOU(optarg);
+            break;
          case 'r':
             params->run_level  = ATOU(optarg);
             if (params->run_level != 0)
                params->setup |= RUN_AS_APP;
             break;
+         case 'S':
+            {
+               char *split = strchr(optarg, ':');
+
+               if (0 != split) {
+                  *split++ = 0;
+                  if (strcmp(split, "split") != 0)
+                     error_exit("invalid shards %s", split);
+                  params->shard_split = 1;
+                  }
+               params->shards = ATOU(optarg);
+               if (params->shards<1 || params->shards>OUT_MAXSHARDS)
+                  error_exit("invalid shards %s", optarg);
+            }
+            break;
          case 's':
             params->sample_in = optarg;
             break;
@@ -545,6 +639,11 @@ int main(int argc, char **argv)
             break;
          }
       } while (c!=-1);
+   if (0 != params->ring_kb && 0 == (params->setup & USE_EGD))
+      error_exit("a ring needs an EGD socket");
+   if ((0 != params->ctl_path || 0 != params->cfg_path || params->handoff_fd >= 0 || 0 != params->sched_low)
+         && 0 != (params->setup & USE_EGD))
+      error_exit("control, settings, handoff and priority are only available when feeding the pool");
    if (params->tests_config == 0)
      params->tests_config = (0 != (params->setup & RUN_AS_APP))? TESTS_DEFAULT_APP : TESTS_DEFAULT_RUN;
    memset(&cmd, 0, sizeof(H_PARAMS));
@@ -556,19 +655,31 @@ int main(int argc, char **argv)
    cmd.testSpec    = params->tests_config;
    cmd.msg_out     = print_msg;
    if (0 != (params->setup & RUN_AS_APP)) {
-      cmd.ioSz = APP_BUFF_SIZE * sizeof(H_UINT);
+      size_t sz = (size_t)params->out_bufs * params->out_kb * 1024 + sysconf(_SC_PAGESIZE);
+
+      if (sz > (H_UINT)-1)
+         error_exit("output buffers too large");
+      cmd.ioSz = (H_UINT)sz;
       if (params->verbose!=0 && 0==(params->setup & RANGE_SPEC))
          params->run_level = 1;
       }
 #ifndef NO_DAEMON
+   else if (0 != (params->setup & USE_EGD))
+      cmd.ioSz = EGD_BUFSZ;
    else  {
       poolSize = get_poolsize();
       i = (poolSize + 7)/8 * sizeof(H_UINT);
       cmd.ioSz = sizeof(struct rand_pool_info) + i *sizeof(H_UINT);
+      if (params->handoff_fd >= 0 && 0 == params->run_level)
+         handoff_open(&cmd);
       }
 #endif
    if (0 != (params->verbose & H_DEBUG_TIME))
       cmd.metering = show_meterInfo;
+#ifndef NO_DAEMON
+   if (0.0 != params->budget_pct && 0 == (params->setup & RUN_AS_APP))
+      budget_open(&cmd);
+#endif
 
    if (0 !=(params->setup & CAPTURE) && 0 != (params->run_level == DIAG_RUN_CAPTURE))
       cmd.options |= H_DEBUG_RAW_OUT;
@@ -586,6 +697,23 @@ int main(int argc, char **argv)
          cmd.options |= H_DEBUG_TEST_IN;
       else usage(1, nopts, long_options, cmds);
       }
+#endif
+   if (params->shards > 1)
+      run_shards(&cmd, bufct, bufrem);
+#ifndef NO_DAEMON
+   if (0 == (params->setup & RUN_AS_APP)) {
+      sigset_t ctl;
+
+      /* held for the signalfd of the daemon loop, a reload during startup waits */
+      sigemptyset(&ctl);
+      sigaddset(&ctl, SIGUSR1);
+      sigaddset(&ctl, SIGHUP);
+      sigprocmask(SIG_BLOCK, &ctl, NULL);
+      }
+   handoff_resume();
+#endif
+#ifdef __ANDROID__
+   daemonCmd = &cmd;
 #endif
    handle = havege_create(&cmd);
    ierr = handle==NULL? H_NOHANDLE : handle->error;
@@ -621,6 +749,8 @@ int main(int argc, char **argv)
       else run_app(handle, bufct, bufrem);
       }
 #ifndef NO_DAEMON
+   else if (0 != (params->setup & USE_EGD))
+      run_egd(handle);
    else run_daemon(handle);
 #endif
    havege_destroy(handle);
@@ -709,6 +839,7 @@ static void run_daemon(    /* RETURN: nothing   */
    else printf ("%s starting up\n", params->daemon);
    if (0 != havege_run(h))
       error_exit("Couldn't initialize HAVEGE rng %d", h->error);
+   handoff_warm(h);
    if (0 != (params->verbose & H_DEBUG_INFO))
      anchor_info(h);
 
@@ -766,10 +897,11 @@ really_carry_on:
 //   fchmod(random_fd,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
 //   fchmod(random_fd,S_IRUSR|S_IRGRP|S_IROTH);
 	
-  output = (struct rand_pool_info *) h->io_buf;
-
 #ifdef __ANDROID__
    pthread_t thread;
+   powerFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+   governor_online(h);
+   governor_topology();
    pthread_create(&thread, NULL, &fn_sleep, NULL );
    FILE *fp=NULL;
 #endif
@@ -778,142 +910,1391 @@ really_carry_on:
       
 //   ioprio_set(IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE,7));
 	
-   int count=0; int wait_time=15000; int ret=0;
-      fd_set write_fd;
-
-	  struct timeval timeout;
-	  timeout.tv_sec = 0; timeout.tv_usec = 150000;
+   struct pollfd pfd[CTL_PFD+CTL_CLIENTS];
+   H_CTLCLIENT   cc[CTL_CLIENTS];
+   sigset_t      ctl;
+   int           current, nbytes, r, rc, i, backoff = 100000;
+
+   /**
+    * The loop sleeps in poll() until the kernel reports the pool below the
+    * write_wakeup_threshold set above, so a daemon with a full pool is never
+    * woken. Under steady demand the poll is also timed from the forecast to
+    * top up the pool before it drains to the threshold. SIGUSR1 and SIGHUP
+    * are taken through a signalfd as control events that log the daemon
+    * statistics and reload the settings file, and the control socket clients
+    * are served from the same poll. On Android the screen sleep thread rings
+    * an eventfd on each transition: the collector is suspended while the
+    * screen is off and the pool is fed from the reserve filled before it was,
+    * until a restart thread hands a new collector back through the eventfd.
+    */
+   sigemptyset(&ctl);
+   sigaddset(&ctl, SIGUSR1);
+   sigaddset(&ctl, SIGHUP);
+   sigprocmask(SIG_BLOCK, &ctl, NULL);
+   pfd[0].fd     = random_fd;
+   pfd[0].events = POLLOUT;
+   pfd[1].fd     = signalfd(-1, &ctl, SFD_NONBLOCK|SFD_CLOEXEC);
+   pfd[1].events = POLLIN;
+   pfd[2].fd     = 0 != params->ctl_path? ctl_listen(params->ctl_path) : -1;
+   pfd[2].events = POLLIN;
+#ifdef __ANDROID__
+   pfd[3].fd     = powerFd;
+#else
+   pfd[3].fd     = -1;
+#endif
+   pfd[3].events = POLLIN;
+   for(i=0;i<CTL_CLIENTS;i++) {
+      pfd[CTL_PFD+i].fd     = -1;
+      pfd[CTL_PFD+i].events = POLLIN;
+      }
+   if (0 != params->cfg_path)
+      daemon_reload(h);
+   dstats.start = daemon_now();
+   sched.since  = dstats.start;
+   if (0 != params->sched_low && 0 != havege_sched(h, 0, params->sched_nice))
+      sched.fails += 1;
+   if (ioctl(random_fd, RNDGETENTCNT, &current) == 0)
+      sched_govern(h, current);
+   for(;;) {
+      if ((rc = poll(pfd, CTL_PFD+CTL_CLIENTS, daemon_timeout())) < 0) {
+         if (errno != EINTR)
+            usleep(100000);
+         continue;
+         }
+      dstats.wakeups += 1;
+      if (rc == 0)
+         dstats.timeouts += 1;
+      budget_charge();
+      if (0 != (pfd[1].revents & POLLIN)) {
+         struct signalfd_siginfo si;
+
+         while(read(pfd[1].fd, &si, sizeof(si)) == sizeof(si))
+            if (si.ssi_signo == SIGHUP)
+               daemon_reload(h);
+            else daemon_info(h);
+         }
+#ifdef __ANDROID__
+      if (0 != (pfd[3].revents & POLLIN)) {
+         uint64_t v;
+
+         if (read(pfd[3].fd, &v, sizeof(v)) == sizeof(v)) {
+            if (NULL == h && NULL != (h = power_ready(poolsize)))
+               pfd[0].events = POLLOUT;
+            if (0 != sleeping && NULL != h)
+               h = power_suspend(h, random_fd, poolsize);
+            else if (0 == sleeping && NULL == h)
+               power_resume(random_fd, poolsize, 0);
+            }
+         }
+#endif
+      if (0 != (pfd[2].revents & POLLIN)) {
+         int fd;
 
-	  int current,nbytes,r,rc;
-	   
-	nbytes = 8; // 12 / 16
-	
-   for(;;) { 
-	   	   
-/*	   
-      count=1;
-      for(count=1;count <= 1;count++) {
-          struct pollfd pfd[1];
-          pfd[0].fd=random_fd;pfd[0].revents = 0;pfd[0].events=POLLOUT;      
-		  
-          int ret = poll(pfd, 1, -1);
-//          int ret = poll(pfd, 1, 6000);
-	      if ( ret > 0 && pfd[0].revents & POLLOUT ) { count = 0 ; break; }
-	  }	  	  
-	  	   			    if (ioctl(random_fd, RNDGETENTCNT, &current) != 0) { 
-		  usleep(1000000);
+         while((fd = accept(pfd[2].fd, NULL, NULL)) >= 0) {
+            for(i=0;i<CTL_CLIENTS && pfd[CTL_PFD+i].fd >= 0;i++);
+            if (i == CTL_CLIENTS) {
+               close(fd);
+               continue;
+               }
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            pfd[CTL_PFD+i].fd = fd;
+            cc[i].ilen = 0;
+            }
+         }
+      for(i=0;i<CTL_CLIENTS;i++)
+         if (0 != pfd[CTL_PFD+i].revents && ctl_client(h, pfd+CTL_PFD+i, cc+i) < 0) {
+            close(pfd[CTL_PFD+i].fd);
+            pfd[CTL_PFD+i].fd = -1;
+            }
+      if (rc > 0 && 0 == (pfd[0].revents & (POLLOUT|POLLERR|POLLHUP)))
+         continue;
+      current = 0;
+      if (ioctl(random_fd, RNDGETENTCNT, &current) != 0) {
+         dstats.ioerrs += 1;
+         usleep(1000000);
+         continue;
+         }
+      if (0 == dstats.ent_n || (H_UINT)current < dstats.ent_min)
+         dstats.ent_min = current;
+      dstats.ent_last = current;
+      dstats.ent_sum += current;
+      dstats.ent_n   += 1;
+      sched_govern(h, current);
+      /* size the batch from the pool deficit, bounded by the watermark */
+      nbytes = poolsize - current;
+      if (nbytes > (batch > 0? batch : threshold))
+         nbytes = batch > 0? batch : threshold;
+      if (nbytes <= 0 || (rc > 0 && current >= threshold)) {
+         daemon_forecast(current, current);
+         if (rc == 0)
+            continue;
+         /* woken without a deficit, the threshold may not be settable */
+         usleep(backoff);
+         if (backoff < 6400000)
+            backoff *= 2;
+         continue;
+         }
+      backoff = 100000;
+      nbytes = (nbytes + 7) / 8;
 #ifdef __ANDROID__
-		  if ( sleeping != 1 ) { sleep(1); continue; } 
+      if (NULL == h && (r = power_take(nbytes)) < nbytes) {
+         power_resume(random_fd, poolsize, 1);
+         if (0 == (nbytes = r)) {
+            /* nothing left to feed, sleep until the collector is back */
+            pfd[0].events = 0;
+            forecast.due  = 0.0;
+            continue;
+            }
+         }
+      if (NULL == h)
+         output = (struct rand_pool_info *) power.out;
+      else
 #endif
-	  } 
-*/      
-	  /* get number of bytes needed to fill pool */
-
-//	  nbytes = (poolSize - current) / 8;
-//	  nbytes = (params->low_water - current) / 8;
-//	  nbytes = (4000 - current) / 8;
-//	  nbytes = (4000 - current) / 8;
-	   	   
-      /* get that many random bytes */
+      {
+      output = (struct rand_pool_info *) h->io_buf;
       r = (nbytes+sizeof(H_UINT)-1)/sizeof(H_UINT);
-      if (havege_rng(h, (H_UINT *)output->buf, r)<1) { 
-		  usleep(1000000); 
-	  }
-
+      if (havege_rng(h, (H_UINT *)output->buf, r)<1) {
+         usleep(1000000);
+         continue;
+         }
+      }
       output->buf_size = nbytes;
       /* entropy is 8 bits per byte */
       output->entropy_count = nbytes * 8;
+      daemon_forecast(current, current + nbytes * 8);
+      if (current >= threshold)
+         dstats.early += 1;
+      if (ioctl(random_fd, RNDADDENTROPY, output) != 0) {
+         dstats.ioerrs += 1;
+         usleep(1000000);
+         }
+      else {
+         dstats.injections += 1;
+         dstats.injected   += nbytes;
+         sched_govern(h, current + nbytes * 8);
+#ifdef __ANDROID__
+         if (NULL == h)
+            power.served += nbytes;
+#endif
+         }
+      }
+	close(random_fd);
+}
+/**
+ * Serve a control client. Each complete line is a command, answered in full
+ * before the next is read.
+ */
+static int ctl_client(     /* RETURN: -1 to close     */
+   H_PTR h,                /* IN: app instance        */
+   struct pollfd *p,       /* IN: client poll slot    */
+   H_CTLCLIENT *c)         /* IN-OUT: client state    */
+{
+   char     out[4096], *nl;
+   ssize_t  r;
+   int      k, n;
+
+   if (0 != (p->revents & (POLLERR|POLLHUP|POLLNVAL)) && 0 == (p->revents & POLLIN))
+      return -1;
+   if ((r = read(p->fd, c->ibuf + c->ilen, CTL_LINESZ - 1 - c->ilen)) <= 0)
+      return (r < 0 && (errno == EAGAIN || errno == EINTR))? 0 : -1;
+   c->ilen += r;
+   while(NULL != (nl = memchr(c->ibuf, '\n', c->ilen))) {
+      *nl = 0;
+      if (nl > c->ibuf && nl[-1] == '\r')
+         nl[-1] = 0;
+      n = ctl_command(h, c->ibuf, out, sizeof(out));
+      if (send(p->fd, out, n, MSG_NOSIGNAL|MSG_DONTWAIT) != n)
+         return -1;
+      k = nl + 1 - c->ibuf;
+      memmove(c->ibuf, nl + 1, c->ilen - k);
+      c->ilen -= k;
+      }
+   return c->ilen < CTL_LINESZ - 1? 0 : -1;
+}
+/**
+ * Run a control command:
+ *
+ *    stats                   live counters, one "name value" per line
+ *    set threshold <bits>    write_wakeup_threshold and injection limit
+ *    set batch <bits>        injection limit, 0 to follow the threshold
+ *    set tests <spec>        continuous tests, as the 'c' group of -o
+ *    set budget <pct>        cpu budget, as -B
+ *    set verbose <mask>      diagnostic mask, as -v
+ */
+static int ctl_command(    /* RETURN: reply length    */
+   H_PTR h,                /* IN: app instance        */
+   char *line,             /* IN: command             */
+   char *out,              /* OUT: reply              */
+   int len)                /* IN: reply space         */
+{
+   static double  lastTime = 0.0;
+   static H_UINT  lastFills = 0;
+   struct h_status status;
+   char           name[16], arg[CTL_LINESZ];
+   double         now = daemon_now(), fps;
+   int            n = 0, v;
+
+   if (strcmp(line, "stats") == 0) {
+      if (0.0 == lastTime)
+         lastTime = dstats.start;
+      n += snprintf(out+n, len-n, "uptime %.1f\n", now - dstats.start);
+      if (NULL != h) {
+         fps = now > lastTime? (h->n_fills - lastFills) / (now - lastTime) : 0.0;
+         lastTime  = now;
+         lastFills = h->n_fills;
+         n += snprintf(out+n, len-n, "fills %u\nfills_per_sec %.2f\ngenerated %.0f\n",
+            h->n_fills, fps, (double)h->n_fills * h->i_collectSz * sizeof(H_UINT));
+         }
+      n += snprintf(out+n, len-n, "wakeups %u\ntimeouts %u\ninjections %u\nearly %u\ninjected %.0f\nioctl_failures %u\n",
+         dstats.wakeups, dstats.timeouts, dstats.injections, dstats.early, dstats.injected, dstats.ioerrs);
+      n += snprintf(out+n, len-n, "entcnt_last %u\nentcnt_min %u\nentcnt_mean %.1f\nentcnt_samples %u\n",
+         dstats.ent_last, dstats.ent_min, dstats.ent_n? dstats.ent_sum / dstats.ent_n : 0.0, dstats.ent_n);
+      n += snprintf(out+n, len-n, "demand %.1f\nforecast_error %.1f\nthreshold %d\nbatch %d\n",
+         dstats.rate, dstats.ferr, threshold, batch > 0? batch : threshold);
+      if (NULL != h) {
+         havege_status(h, &status);
+         n += snprintf(out+n, len-n, "tests_tot %s\ntests_cont %s\n", status.tot_tests, status.prod_tests);
+         n += snprintf(out+n, len-n, "tot_a %u/%u\ntot_b %u/%u\n",
+            status.n_tests[H_OLT_TOT_A_P], status.n_tests[H_OLT_TOT_A_P] + status.n_tests[H_OLT_TOT_A_F],
+            status.n_tests[H_OLT_TOT_B_P], status.n_tests[H_OLT_TOT_B_P] + status.n_tests[H_OLT_TOT_B_F]);
+         n += snprintf(out+n, len-n, "cont_a %u/%u\ncont_b %u/%u\nhealth %u/%u\ncoverage %.3f\nlast_test8 %.5f\n",
+            status.n_tests[H_OLT_PROD_A_P], status.n_tests[H_OLT_PROD_A_P] + status.n_tests[H_OLT_PROD_A_F],
+            status.n_tests[H_OLT_PROD_B_P], status.n_tests[H_OLT_PROD_B_P] + status.n_tests[H_OLT_PROD_B_F],
+            status.n_tests[H_OLT_PROD_H_P], status.n_tests[H_OLT_PROD_H_P] + status.n_tests[H_OLT_PROD_H_F],
+            status.coverage, status.last_test8);
+         }
+#ifdef __ANDROID__
+      n += snprintf(out+n, len-n, "power %s\nsleeps %u\nwakes %u\nwakes_early %u\nwake_failures %u\nsleep_ms %.1f\nwake_ms %.1f\nreserve %u\nreserve_served %.0f\n",
+         NULL != h? "running" : (0 != power.resuming? "resuming" : "suspended"), power.sleeps, power.wakes, power.early,
+         __sync_add_and_fetch(&power.fails, 0), power.suspend_ms, power.resume_ms, power.held - power.pos, power.served);
+#endif
+      if (NULL != handoff)
+         n += snprintf(out+n, len-n, "restarts %u\nresume_ms %.1f\nwarm_ms %.1f\nresumed %u\n",
+            handoff->restarts, handoff->resume_ms, handoff->warm_ms, handoff->resumed);
+      if (NULL != budget) {
+         double tokens, spent, own, waited;
+         H_UINT throttles;
+
+         while(!__sync_bool_compare_and_swap(&budget->lock, 0, 1));
+         budget_refill(budget, now);
+         tokens    = budget->tokens;
+         spent     = budget->spent;
+         own       = budget->daemon;
+         waited    = budget->waited;
+         throttles = budget->throttles;
+         __sync_lock_release(&budget->lock);
+         n += snprintf(out+n, len-n, "budget_pct %.2f\nbudget_window %u\nbudget_tokens_ms %.1f\nbudget_cpu_secs %.3f\nbudget_daemon_secs %.3f\nbudget_throttles %u\nbudget_throttle_secs %.3f\n",
+            budget->rate * 100.0, params->budget_secs, tokens * 1000.0, spent, own, throttles, waited);
+         }
+      if (0 != params->sched_low) {
+         sched.secs[sched.idle] += now - sched.since;
+         sched.since = now;
+         n += snprintf(out+n, len-n, "sched_class %s\nsched_idle_secs %.1f\nsched_normal_secs %.1f\nsched_switches %u\nsched_failures %u\n",
+            sched.idle? "idle" : "normal", sched.secs[1], sched.secs[0], sched.switches, sched.fails);
+         }
+#ifdef __ANDROID__
+      n += sysfs_info(out+n, len-n);
+#endif
+      }
+   else if (sscanf(line, "set %15s %255s", name, arg) == 2) {
+      v = atoi(arg);
+      if (strcmp(name, "threshold") == 0) {
+         if (v < 1 || v > (int)poolSize)
+            return snprintf(out, len, "error threshold must be 1-%u\n", poolSize);
+         threshold = v;
+         set_watermark(threshold);
+         set_low_watermark(threshold);
+         }
+      else if (strcmp(name, "batch") == 0) {
+         if (v < 0 || v > (int)poolSize)
+            return snprintf(out, len, "error batch must be 0-%u\n", poolSize);
+         batch = v;
+         }
+      else if (strcmp(name, "tests") == 0) {
+         if (NULL == h)
+            return snprintf(out, len, "error collector suspended\n");
+         if (H_NOERR != havege_tests_config(h, arg))
+            return snprintf(out, len, "error tests %s rejected\n", arg);
+         strcpy(testsSpec, arg);
+         }
+      else if (strcmp(name, "budget") == 0) {
+         double pct = atof(arg);
+
+         if (NULL == budget)
+            return snprintf(out, len, "error no budget, start with -B\n");
+         if (pct <= 0.0 || pct > 100.0)
+            return snprintf(out, len, "error budget must be above 0 and at most 100\n");
+         while(!__sync_bool_compare_and_swap(&budget->lock, 0, 1));
+         budget_refill(budget, now);
+         budget->rate = pct / 100.0;
+         budget->cap  = budget->rate * params->budget_secs;
+         if (budget->tokens > budget->cap)
+            budget->tokens = budget->cap;
+         __sync_lock_release(&budget->lock);
+         }
+      else if (strcmp(name, "verbose") == 0) {
+         params->verbose = v;
+         if (NULL != h)
+            havege_options(h, v & 0xff);
+         }
+      else return snprintf(out, len, "error unknown setting %s\n", name);
+      print_msg("setting %s: %s\n", name, arg);
+      }
+   else return snprintf(out, len, "error unknown command\n");
+   if (n >= len - 4)
+      n = len - 4;
+   return n + snprintf(out+n, len-n, "ok\n");
+}
+/**
+ * Open the control socket, readable by the owner only
+ */
+static int ctl_listen(     /* RETURN: socket or -1    */
+   const char *path)       /* IN: socket path         */
+{
+   struct sockaddr_un   sa;
+   int                  fd;
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(sa.sun_path))
+      error_exit("Socket path too long: %s", path);
+   strcpy(sa.sun_path, path);
+   unlink(path);
+   fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+   if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, CTL_CLIENTS) < 0)
+      error_exit("Couldn't open socket \"%s\": %s", path, strerror(errno));
+   chmod(path, 0600);
+   return fd;
+}
+/**
+ * Record a pool level sample and forecast the next wakeup. The demand rate is the
+ * drain over the sample ring divided by the time it covers. The forecast error is
+ * the difference between the level predicted from the last sample and the level
+ * read, smoothed over recent samples. The wakeup is kept as a deadline so that
+ * control and signal events do not push it back, it is cleared when there is no
+ * demand worth waking for.
+ */
+static void daemon_forecast(  /* RETURN: nothing             */
+   int current,               /* IN: pool level read         */
+   int level)                 /* IN: pool level after inject */
+{
+   H_FORECAST     *f = &forecast;
+   double         now = daemon_now(), dt = 0.0, drain = 0.0, err, tte;
+   H_UINT         i, n;
+
+   if (f->n > 0) {
+      i = (f->n - 1) % FORECAST_RING;
+      f->dt[i]    = now - f->last;
+      f->drain[i] = f->level - current;
+      err = f->level - dstats.rate * f->dt[i] - current;
+      dstats.ferr += ((err < 0.0? -err : err) - dstats.ferr) / 8.0;
+      n = f->n < FORECAST_RING? f->n : FORECAST_RING;
+      for(i=0;i<n;i++) {
+         dt    += f->dt[i];
+         drain += f->drain[i];
+         }
+      dstats.rate = (dt > 0.0 && drain > 0.0)? drain / dt : 0.0;
+      }
+   f->n    += 1;
+   f->last  = now;
+   f->level = level;
+   f->due   = 0.0;
+   if (dstats.rate <= 0.0 || level <= threshold)
+      return;
+   tte = (level - threshold) / dstats.rate;
+   if (tte > FORECAST_MAX)
+      return;
+   tte *= (double)(FORECAST_LEAD - 1) / FORECAST_LEAD;
+   f->due = now + (tte < 0.01? 0.01 : tte);
+}
+/**
+ * Poll timeout in ms left to the forecast wakeup, -1 if none is due
+ */
+static int daemon_timeout( /* RETURN: poll timeout ms     */
+   void)                   /* IN: nothing                 */
+{
+   double left;
+
+   if (forecast.due <= 0.0)
+      return -1;
+   left = (forecast.due - daemon_now()) * 1000.0;
+   return left <= 0.0? 0 : (int)left + 1;
+}
+/**
+ * Log the daemon loop statistics
+ */
+static void daemon_info(   /* RETURN: nothing   */
+   H_PTR h)                /* IN: app instance  */
+{
+   char buf[120];
 
+   if (NULL != h)
+      anchor_info(h);
+   if (NULL != budget)
+      print_msg("budget: %.2f%% of a core, collector cpu: %.3f s, daemon cpu: %.3f s, throttled: %u fills for %.3f s\n",
+         budget->rate * 100.0, budget->spent, budget->daemon, budget->throttles, budget->waited);
+   if (0 != (params->setup & USE_EGD)) {
+      print_msg("wakeups: %u, clients: %u (%u refused), served: %s\n",
+         dstats.wakeups, dstats.clients, dstats.refused, ppSize(buf, dstats.served));
+      return;
+      }
+   print_msg("wakeups: %u, injections: %u (%u early), injected: %s\n",
+      dstats.wakeups, dstats.injections, dstats.early, ppSize(buf, dstats.injected));
+   print_msg("demand: %.1f bits/s, forecast error: %.1f bits\n", dstats.rate, dstats.ferr);
+}
+/**
+ * Current monotonic time in seconds, wall clock time if there is no monotonic clock
+ */
+static double daemon_now(  /* RETURN: seconds   */
+   void)                   /* IN: nothing       */
+{
+   struct timeval tm;
+#if defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+
+   if (0 == clock_gettime(CLOCK_MONOTONIC, &ts))
+      return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+   gettimeofday(&tm, NULL);
+   return tm.tv_sec + tm.tv_usec * 1e-6;
+}
+/**
+ * Map the warm restart state passed by the supervisor. A daemon started without
+ * a valid state runs cold. When no cache sizes are given, those tuned by the
+ * previous daemon are used, which skips the tuning sources.
+ */
+static void handoff_open(  /* RETURN: nothing         */
+   H_PARAMS *cmd)          /* IN-OUT: collector setup */
+{
+   struct stat st;
+   H_HANDOFF   *s;
+
+   handoffStart = daemon_now();
+   if (fstat(params->handoff_fd, &st) < 0 || st.st_size < (off_t)sizeof(H_HANDOFF)) {
+      print_msg("handoff: no state on descriptor %d\n", params->handoff_fd);
+      return;
+      }
+   s = (H_HANDOFF *) mmap(NULL, sizeof(H_HANDOFF), PROT_READ|PROT_WRITE, MAP_SHARED, params->handoff_fd, 0);
+   if (s == MAP_FAILED || s->magic != HANDOFF_MAGIC || s->version != HANDOFF_VERSION) {
+      print_msg("handoff: state on descriptor %d not recognized\n", params->handoff_fd);
+      if (s != MAP_FAILED)
+         munmap(s, sizeof(H_HANDOFF));
+      return;
+      }
+   if (0 == cmd->icacheSize && 0 == cmd->dcacheSize && 0 != s->i_cache && 0 != s->d_cache) {
+      cmd->icacheSize = s->i_cache;
+      cmd->dcacheSize = s->d_cache;
+      }
+   if (cmd->ioSz < HANDOFF_RESERVE)
+      cmd->ioSz = HANDOFF_RESERVE;
+   s->resume_ms = s->warm_ms = 0.0;
+   s->resumed   = 0;
+   handoff = s;
+}
+/**
+ * Inject the reserve left by the previous daemon while the collector warms up.
+ * The reserve is taken out of the state before use so no byte of it is ever
+ * injected twice, and is fed to the pool from a child process whenever the
+ * pool is below the wakeup threshold. handoff_warm() stops the child.
+ */
+static void handoff_resume(   /* RETURN: nothing         */
+   void)                      /* IN: nothing             */
+{
+   static H_UINT8          held[HANDOFF_RESERVE];
+   struct rand_pool_info   *out;
+   struct pollfd           pfd;
+   sigset_t                mask;
+   H_UINT                  len, pos = 0;
+   int                     current, n;
+
+   if (NULL == handoff || 0 == (len = handoff->held) || len > HANDOFF_RESERVE)
+      return;
+   memcpy(held, handoff->reserve, len);
+   handoff->held = 0;
+   memset(handoff->reserve, 0, len);
+   if ((resumePid = fork()) != 0) {
+      if (resumePid < 0)
+         resumePid = 0;
+      memset(held, 0, len);
+      return;
+      }
+   sigemptyset(&mask);
+   sigprocmask(SIG_SETMASK, &mask, NULL);
+   signal(SIGTERM, SIG_DFL);
+   out = (struct rand_pool_info *) malloc(sizeof(struct rand_pool_info) + HANDOFF_RESERVE);
+   pfd.fd     = open(params->random_device, O_RDWR);
+   pfd.events = POLLOUT;
+   while(NULL != out && pfd.fd >= 0 && pos < len) {
+      if (ioctl(pfd.fd, RNDGETENTCNT, &current) != 0)
+         break;
+      n = ((int)poolSize - current) / 8;
+      if (n > (int)(len - pos))
+         n = len - pos;
+      if (n <= 0) {
+         poll(&pfd, 1, -1);
+         continue;
+         }
+      memcpy(out->buf, held + pos, n);
+      out->buf_size      = n;
+      out->entropy_count = n * 8;
+      if (ioctl(pfd.fd, RNDADDENTROPY, out) != 0)
+         break;
+      if (0 == handoff->resumed)
+         handoff->resume_ms = (daemon_now() - handoffStart) * 1000.0;
+      handoff->resumed += n;
+      pos += n;
+      }
+   memset(held, 0, len);
+   if (NULL != out)
+      memset(out->buf, 0, HANDOFF_RESERVE);
+   _exit(0);
+}
+/**
+ * The collector is ready: stop injecting the old reserve, record the tuning and
+ * quarantine fresh tested output as the reserve of the next daemon
+ */
+static void handoff_warm(  /* RETURN: nothing   */
+   H_PTR h)                /* IN: app instance  */
+{
+   struct h_status status;
+
+   if (NULL == handoff)
+      return;
+   if (resumePid > 0) {
+      kill(resumePid, SIGKILL);
+      waitpid(resumePid, NULL, 0);
+      resumePid = 0;
+      }
+   havege_status(h, &status);
+   handoff->i_cache = status.i_cache;
+   handoff->d_cache = status.d_cache;
+   handoff->warm_ms = (daemon_now() - handoffStart) * 1000.0;
+   if (havege_rng(h, h->io_buf, HANDOFF_RESERVE / sizeof(H_UINT)) < 1)
+      return;
+   memcpy(handoff->reserve, h->io_buf, HANDOFF_RESERVE);
+   memset(h->io_buf, 0, HANDOFF_RESERVE);
+   __sync_synchronize();
+   handoff->held = HANDOFF_RESERVE;
+   if (0 != (params->verbose & H_DEBUG_INFO))
+      print_msg("handoff: restart %u, resumed %u bytes at %.1f ms, warm at %.1f ms\n",
+         handoff->restarts, handoff->resumed, handoff->resume_ms, handoff->warm_ms);
+}
 #ifdef __ANDROID__
-	   if ( sleeping == 1 ) {
-		wait_time = 30000;
-	  
-	  timeout.tv_sec = 300;
-      timeout.tv_usec = 0;
-		
-	} 
+/**
+ * Called from the screen sleep thread on each transition. The daemon loop acts
+ * on the new state, the time is kept to measure how long it takes.
+ */
+static void power_event(   /* RETURN: nothing   */
+   void)                   /* IN: nothing       */
+{
+   uint64_t one = 1;
+
+   power.at = daemon_now();
+   if (powerFd >= 0 && write(powerFd, &one, sizeof(one)) != sizeof(one))
+      print_msg("power: event lost\n");
+}
+/**
+ * Restart the collector. The pool is first topped up from what is left of the
+ * reserve, then the collector and its tot tests are started by power_start() on
+ * a thread of their own so the daemon loop keeps feeding the pool from the
+ * reserve meanwhile. The tuning found before suspending is reused. A restart
+ * already under way is left to finish.
+ */
+static void power_resume(     /* RETURN: nothing            */
+   int fd,                    /* IN: random device          */
+   int poolsize,              /* IN: pool size in bits      */
+   H_UINT early)              /* IN: reserve ran out asleep */
+{
+   struct rand_pool_info   *out = (struct rand_pool_info *) power.out;
+   int                     current, n;
+
+   if (0 != power.resuming)
+      return;
+   if (0 != early) {
+      power.at     = daemon_now();
+      power.early += 1;
+      }
+   else if (ioctl(fd, RNDGETENTCNT, &current) == 0
+         && (n = power_take((poolsize - current) / 8)) > 0) {
+      out->buf_size      = n;
+      out->entropy_count = n * 8;
+      if (ioctl(fd, RNDADDENTROPY, out) == 0)
+         power.served += n;
+      }
+   daemonCmd->options = params->verbose & 0xff;
+   memcpy(&powerCmd, daemonCmd, sizeof(H_PARAMS));
+   if (0 != pthread_create(&powerThread, NULL, power_start, NULL)) {
+      __sync_fetch_and_add(&power.fails, 1);
+      print_msg("power: couldn't start the collector restart\n");
+      return;
+      }
+   power.resuming = 1;
+}
+/**
+ * Restart thread. A collector that fails to start is released and tried again
+ * after a growing delay, the daemon keeps running on the reserve meanwhile. The
+ * instance is handed to the daemon loop through powerReady and an event.
+ */
+static void *power_start(  /* RETURN: nothing   */
+   void *arg)              /* IN: unused        */
+{
+   H_PTR    h;
+   H_UINT   wait = 1;
+   uint64_t one = 1;
+
+   (void)arg;
+   for(;;) {
+      h = havege_create(&powerCmd);
+      if (NULL != h && H_NOERR == h->error && 0 == havege_run(h))
+         break;
+      print_msg("power: couldn't resume haveged (%d), retry in %u s\n",
+         NULL == h? H_NOHANDLE : h->error, wait);
+      havege_destroy(h);
+      __sync_fetch_and_add(&power.fails, 1);
+      sleep(wait);
+      if (wait < POWER_RETRY)
+         wait *= 2;
+      }
+   __sync_synchronize();
+   powerReady = h;
+   if (write(powerFd, &one, sizeof(one)) != sizeof(one))
+      print_msg("power: event lost\n");
+   return NULL;
+}
+/**
+ * Take over the collector started by power_start(), if it is ready. What is
+ * left of the reserve is dropped, and the continuous tests last set through the
+ * control socket and the class last set by sched_govern() are applied again.
+ */
+static H_PTR power_ready(  /* RETURN: instance or NULL */
+   int poolsize)           /* IN: pool size in bits    */
+{
+   struct rand_pool_info   *out = (struct rand_pool_info *) power.out;
+   H_PTR                   h = powerReady;
+
+   if (NULL == h)
+      return NULL;
+   pthread_join(powerThread, NULL);
+   powerReady     = NULL;
+   power.resuming = 0;
+   if (0 != testsSpec[0])
+      havege_tests_config(h, testsSpec);
+   if (0 != params->sched_low && 0 != havege_sched(h, sched.idle, params->sched_nice))
+      sched.fails += 1;
+   memset(power.reserve, 0, power.held);
+   if (NULL != out)
+      memset(out->buf, 0, poolsize / 8);
+   power.held = power.pos = 0;
+   handle = h;
+   power.wakes += 1;
+   power.resume_ms = (daemon_now() - power.at) * 1000.0;
+   if (0 != (params->verbose & H_DEBUG_INFO))
+      print_msg("power: collector resumed in %.1f ms\n", power.resume_ms);
+   return h;
+}
+/**
+ * Stop collecting while the screen is off. The pool is topped up and the
+ * reserve filled with tested output, then the instance is destroyed, which
+ * stops the collectors and releases the collection and test memory.
+ */
+static H_PTR power_suspend(   /* RETURN: NULL               */
+   H_PTR h,                   /* IN: app instance           */
+   int fd,                    /* IN: random device          */
+   int poolsize)              /* IN: pool size in bits      */
+{
+   struct rand_pool_info   *out = (struct rand_pool_info *) h->io_buf;
+   struct h_status         status;
+   H_UINT                  chunk = (daemonCmd->ioSz - sizeof(struct rand_pool_info)) & ~(sizeof(H_UINT) - 1), n;
+   int                     current;
+
+   if (NULL == power.out && NULL == (power.out = malloc(sizeof(struct rand_pool_info) + poolsize / 8 + sizeof(H_UINT))))
+      return h;
+   if (ioctl(fd, RNDGETENTCNT, &current) == 0 && (n = (poolsize - current) / 8) > 0
+         && havege_rng(h, (H_UINT *)out->buf, (n + sizeof(H_UINT) - 1) / sizeof(H_UINT)) > 0) {
+      out->buf_size      = n;
+      out->entropy_count = n * 8;
+      if (ioctl(fd, RNDADDENTROPY, out) == 0) {
+         dstats.injections += 1;
+         dstats.injected   += n;
+         }
+      }
+   for(power.held = power.pos = 0;power.held < POWER_RESERVE;power.held += n) {
+      n = POWER_RESERVE - power.held < chunk? POWER_RESERVE - power.held : chunk;
+      if (havege_rng(h, (H_UINT *)out->buf, n / sizeof(H_UINT)) < 1)
+         break;
+      memcpy(power.reserve + power.held, out->buf, n);
+      }
+   havege_status(h, &status);
+   daemonCmd->icacheSize = status.i_cache;
+   daemonCmd->dcacheSize = status.d_cache;
+   havege_destroy(h);
+   handle = NULL;
+   power.sleeps += 1;
+   power.suspend_ms = (daemon_now() - power.at) * 1000.0;
+   if (0 != (params->verbose & H_DEBUG_INFO))
+      print_msg("power: collector suspended in %.1f ms, %u bytes held\n", power.suspend_ms, power.held);
+   return NULL;
+}
+/**
+ * Move up to nbytes of the reserve to the injection buffer
+ */
+static int power_take(     /* RETURN: bytes moved  */
+   int nbytes)             /* IN: bytes wanted     */
+{
+   struct rand_pool_info   *out = (struct rand_pool_info *) power.out;
+   int                     n = power.held - power.pos;
+
+   if (nbytes < n)
+      n = nbytes;
+   if (n <= 0 || NULL == out)
+      return 0;
+   memcpy(out->buf, power.reserve + power.pos, n);
+   memset(power.reserve + power.pos, 0, n);
+   power.pos += n;
+   return n;
+}
 #endif
-	   
-/*	   
-// FOLLOWING IS RANDOM DEVICE
-	   
-	  count=1; 
-      for(count=1;count <= 1;count++) {
-          struct pollfd pfdout[1];
-          pfdout[0].fd=random_fd;pfdout[0].revents = 0;pfdout[0].events=POLLOUT;      
-		  
-          ret = poll(pfdout, 1, wait_time);
-	      if ( ret > 0 && pfdout[0].revents & POLLOUT ) { ret = 1 ; break; } else sleep(1000);
-	  }	  	  
-
-	if ( ret == 0 && wait_time == 15000 ) { wait_time = 30000 ; continue; }
-
-	if ( ret > 0 ) wait_time = 15000;
-	   	   
-// END RANDOM DEVICE LOGIC
-*/	   
-
-// BEGIN SELECT LOGIC
-	   
-      FD_ZERO(&write_fd);
-      FD_SET(random_fd, &write_fd);	  
-	   
-	   count=1;
-      for(;;)  {
-
-//       int rc = select(random_fd+1, NULL, &write_fd, NULL, NULL);
-         rc = select(random_fd+1, NULL, &write_fd, NULL, &timeout);
-//Timeout
-		 if ( rc > 0 ) {  count = 0; break; }
-		  			  
-//Normal		  
-         if ( rc == 0 ) { count = 1 ; break; }
-		  
-//		 if ( ( rc == 0 ) && ( sleeping == 1 ) ) continue; 
-//         if (errno != EINTR) { count = 2 ; goto carry_on; } 
-//         if ( rc < 0 ) { count = 2 ; sleep(7); close(random_fd); sleep(7); goto really_carry_on; }
-         if ( rc < 0 ) { count = 2 ; usleep(100000); goto carry_on; }
-//            error_exit("Select error: %s", strerror(errno));
-	      	
+/**
+ * Metering call-back enforcing the collector cpu budget. The cpu time of each
+ * fill, the havege_gather() passes and their tests, is charged to the bucket
+ * at the end of the fill. A fill that starts with the bucket in debt first
+ * waits until the debt is repaid, which keeps the collector cpu time averaged
+ * over the window within the budget. Runs in the collector, which is a child
+ * process in threaded builds, so the fill start time and budgetOwn are per
+ * process copies.
+ */
+static void budget_meter(  /* RETURN: nothing   */
+   H_UINT id,              /* IN: collector     */
+   H_UINT event)           /* IN: start/stop    */
+{
+   static double  cpuStart;
+   struct timespec ts;
+   H_BUDGET       *b = budget;
+   double         cpu, wait = 0.0;
+
+   if (event == 0) {
+      while(!__sync_bool_compare_and_swap(&b->lock, 0, 1));
+      budget_refill(b, daemon_now());
+      if (b->tokens < 0.0) {
+         wait = -b->tokens / b->rate;
+         b->throttles += 1;
+         b->waited    += wait;
          }
+      __sync_lock_release(&b->lock);
+      if (wait > 0.0) {
+         ts.tv_sec  = (time_t)wait;
+         ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+         while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+         }
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+      cpuStart = ts.tv_sec + ts.tv_nsec * 1e-9;
+      }
+   else {
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+      if ((cpu = ts.tv_sec + ts.tv_nsec * 1e-9 - cpuStart) < 0.0)
+         cpu = 0.0;
+      while(!__sync_bool_compare_and_swap(&b->lock, 0, 1));
+      b->tokens -= cpu;
+      b->spent  += cpu;
+      b->fills  += 1;
+      budgetOwn += cpu;
+      __sync_lock_release(&b->lock);
+      }
+   if (0 != (params->verbose & H_DEBUG_TIME))
+      show_meterInfo(id, event);
+}
+/**
+ * Charge the cpu time of the daemon process since the last charge, so the budget
+ * bounds all of haveged and not just the fills. Called on each pass of the daemon
+ * and EGD loops, it reads the process clock at most every BUDGET_TICK seconds.
+ * Fills metered in this process, as a single collector's are, were charged by
+ * budget_meter() and are taken off. Only fills wait for the bucket, so the
+ * daemon's own time is repaid by holding back the next fill.
+ */
+static void budget_charge(   /* RETURN: nothing   */
+   void)                      /* IN: nothing       */
+{
+   static double  cpuLast = -1.0, tickLast;
+   struct timespec ts;
+   H_BUDGET       *b = budget;
+   double         cpu, now, used;
 
-// END SELECT LOGIC
-	   
-	   current=0;
-	   if (ioctl(random_fd, RNDGETENTCNT, &current) == 0) {
-//		   if ( current >= ( threshold - 96 ) ) {
-		   if ( current >= threshold ) {
-//		   if ( current >= ( poolsize - 8 ) ) {
-//			   if ( current >= ( threshold + 96 ) ) read_file("/dev/random");
-			   usleep(100000);
-			   count = 0;
-			   goto carry_on;
-		   }			
+   if (NULL == b)
+      return;
+   now = daemon_now();
+   if (cpuLast >= 0.0 && now - tickLast < BUDGET_TICK)
+      return;
+   if (0 != clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts))
+      return;
+   tickLast = now;
+   cpu = ts.tv_sec + ts.tv_nsec * 1e-9;
+   while(!__sync_bool_compare_and_swap(&b->lock, 0, 1));
+   used = cpu - cpuLast - budgetOwn;
+   budgetOwn = 0.0;
+   if (cpuLast >= 0.0 && used > 0.0) {
+      b->tokens -= used;
+      b->daemon += used;
+      }
+   __sync_lock_release(&b->lock);
+   cpuLast = cpu;
+}
+/**
+ * Map the budget shared by the collectors and start with a full bucket, so the
+ * startup tuning and tests are not held back.
+ */
+static void budget_open(   /* RETURN: nothing         */
+   H_PARAMS *cmd)          /* IN-OUT: collector setup */
+{
+   H_BUDGET *b;
+
+   b = (H_BUDGET *) mmap(NULL, sizeof(H_BUDGET), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+   if (MAP_FAILED == b)
+      error_exit("budget: %s", strerror(errno));
+   memset(b, 0, sizeof(H_BUDGET));
+   b->rate   = params->budget_pct / 100.0;
+   b->cap    = b->rate * params->budget_secs;
+   b->tokens = b->cap;
+   b->last   = daemon_now();
+   budget = b;
+   cmd->metering = budget_meter;
+}
+/**
+ * Add the tokens earned since the last refill. Called with the bucket locked.
+ */
+static void budget_refill( /* RETURN: nothing   */
+   H_BUDGET *b,            /* IN: the bucket    */
+   double now)             /* IN: seconds       */
+{
+   if (now > b->last) {
+      b->tokens += (now - b->last) * b->rate;
+      if (b->tokens > b->cap)
+         b->tokens = b->cap;
+      }
+   b->last = now;
+}
+/**
+ * Apply the settings file. Each line is a control socket setting without the
+ * "set", e.g. "threshold 1024" or "tests cb". Blank lines and lines starting
+ * with '#' are ignored. The running collectors, their tuning and test state
+ * are kept, only the settings named in the file change.
+ */
+static void daemon_reload( /* RETURN: nothing   */
+   H_PTR h)                /* IN: app instance  */
+{
+   FILE  *f;
+   char  line[CTL_LINESZ], cmd[CTL_LINESZ+4], out[256], *p, *e;
+   int   n = 0;
+
+   if (0 == params->cfg_path) {
+      print_msg("reload: no settings file\n");
+      return;
+      }
+   if (NULL == (f = fopen(params->cfg_path, "r"))) {
+      print_msg("reload: %s: %s\n", params->cfg_path, strerror(errno));
+      return;
+      }
+   while(NULL != fgets(line, sizeof(line), f)) {
+      for(p = line;*p == ' ' || *p == '\t';p++);
+      for(e = p + strlen(p);e > p && (e[-1] == '\n' || e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t');e--);
+      *e = 0;
+      if (*p == 0 || *p == '#')
+         continue;
+      snprintf(cmd, sizeof(cmd), "set %s", p);
+      if (ctl_command(h, cmd, out, sizeof(out)) > 0 && 0 == strncmp(out, "error", 5))
+         print_msg("reload: %s: %s", params->cfg_path, out + 6);
+      else n += 1;
+      }
+   fclose(f);
+   print_msg("reload: %d settings applied from %s\n", n, params->cfg_path);
+}
+/**
+ * Move the collector between SCHED_IDLE and its normal class. It idles once the
+ * pool is full or at the threshold and any handoff reserve is full, and returns to normal
+ * only when the pool falls below the low mark, so a pool hovering around the
+ * threshold does not flip the class on every injection.
+ */
+static void sched_govern(  /* RETURN: nothing            */
+   H_PTR h,                /* IN: app instance           */
+   int level)              /* IN: pool level in bits     */
+{
+   H_UINT   idle = sched.idle;
+   double   now;
 
-    if (ioctl(random_fd, RNDADDENTROPY, output) != 0) 
-	  usleep(1000000);
+   if (0 == params->sched_low || NULL == h)
+      return;
+   if (level < (int)params->sched_low)
+      idle = 0;
+   else if ((level >= threshold || level >= (int)poolSize) && (NULL == handoff || handoff->held == HANDOFF_RESERVE))
+      idle = 1;
+   if (idle == sched.idle)
+      return;
+   if (0 != havege_sched(h, idle, params->sched_nice)) {
+      sched.fails += 1;
+      return;
+      }
+   now = daemon_now();
+   sched.secs[sched.idle] += now - sched.since;
+   sched.since = now;
+   sched.idle  = idle;
+   sched.switches += 1;
+}
+/**
+ * EGD service output is taken from the instance io_buf, refilled by one large
+ * havege_rng() read whenever it is exhausted. Shared by all clients.
+ */
+static H_UINT egdPos, egdLen;
 
-		}
+static void egd_take(      /* RETURN: nothing         */
+   H_PTR h,                /* IN: app instance        */
+   H_UINT8 *dst,           /* OUT: destination        */
+   H_UINT n)               /* IN: bytes wanted        */
+{
+   H_UINT8  *src = (H_UINT8 *)h->io_buf;
+   H_UINT   k;
+
+   while(n > 0) {
+      if (egdPos >= egdLen) {
+         if (havege_rng(h, (H_UINT *)src, h->i_readSz/sizeof(H_UINT))<1)
+            error_exit("RNG failed! %d", h->error);
+         egdPos = 0;
+         egdLen = h->i_readSz - h->i_readSz % sizeof(H_UINT);
+         }
+      k = egdLen - egdPos;
+      if (k > n)
+         k = n;
+      memcpy(dst, src + egdPos, k);
+      egdPos += k;
+      dst += k;
+      n -= k;
+      }
+}
+/**
+ * The shared memory ring, see havegering.h. The daemon is the only producer and
+ * fills free cells from egd_take() whenever its loop runs. When the ring is full
+ * the producer arms wake and consumers that free a cell signal ringEfd.
+ */
+static H_RING  *ring;
+static int     ringFd = -1, ringEfd = -1;
 
-//	  if ( fp != NULL ) { fclose(fp); fp = NULL; }
+static void egd_ring_create(  /* RETURN: nothing         */
+   H_UINT kb)                 /* IN: ring size in KB     */
+{
+   H_UINT   n, i;
+   size_t   sz;
 
-carry_on:
-	   
-	   if ( count == 0 ) {
-		   nbytes=8;
-//		   nbytes == 8 ? ( nbytes=9 ) : ( nbytes=8 );
-		   timeout.tv_sec = 0; timeout.tv_usec = 150000;
-	   }
-	   else
-	   {
-		  nbytes == 14 ? ( nbytes=15 ) : ( nbytes=14 );
- 		  timeout.tv_sec = 1; timeout.tv_usec = 0;
-	   }
-
-//	usleep(1000); 
+   for(n=2;(n<<1) <= kb * 1024 / HRING_CELL;n<<=1);
+   sz = HRING_SIZE(n, HRING_CELL);
+#ifdef SYS_memfd_create
+   ringFd = syscall(SYS_memfd_create, "haveged", 1);  /* MFD_CLOEXEC     */
+#endif
+   if (ringFd < 0 || ftruncate(ringFd, sz) < 0)
+      error_exit("Couldn't create ring: %s", strerror(errno));
+   ring = (H_RING *) mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, ringFd, 0);
+   if (ring == MAP_FAILED || (ringEfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+      error_exit("Couldn't map ring: %s", strerror(errno));
+   ring->nCells  = n;
+   ring->cellSz  = HRING_CELL;
+   ring->offset  = HRING_OFFSET(n);
+   for(i=0;i<n;i++)
+      ring->seq[i] = i;
+   ring->version = HRING_VERSION;
+   __sync_synchronize();
+   ring->magic   = HRING_MAGIC;
+}
+/**
+ * Publish into every free cell, waking any consumers waiting for data
+ */
+static void egd_ring_fill( /* RETURN: nothing         */
+   H_PTR h)                /* IN: app instance        */
+{
+   H_UINT   mask = ring->nCells - 1, pos, n = 0;
 
-    }
-	close(random_fd);
+   for(;;) {
+      pos = ring->tail;
+      if (ring->seq[pos & mask] != pos) {
+         if (0 != ring->wake)
+            break;
+         ring->wake = 1;               /* arm, then look again */
+         __sync_synchronize();
+         continue;
+         }
+      ring->wake = 0;
+      egd_take(h, HRING_DATA(ring, pos), ring->cellSz);
+      __sync_synchronize();
+      ring->seq[pos & mask] = pos + 1;
+      ring->tail = pos + 1;
+      n += 1;
+      }
+   if (n > 0) {
+      __sync_fetch_and_add(&ring->published, n);
+      if (0 != ring->waiters)
+         syscall(SYS_futex, &ring->published, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+      dstats.served += (double)n * ring->cellSz;
+      }
+}
+/**
+ * Pass the ring memfd and eventfd to a client, with a status byte. Any holder of
+ * the memfd can read cells claimed by other consumers and rewrite the ring, so it
+ * is only passed to a peer running as root or as the daemon user or group.
+ */
+static int egd_ring_send(  /* RETURN: 0 on success    */
+   int fd)                 /* IN: client socket       */
+{
+   struct msghdr  msg;
+   struct iovec   iov;
+   struct cmsghdr *cm;
+   union {
+      struct cmsghdr cm;
+      char           space[CMSG_SPACE(2 * sizeof(int))];
+   } ctl;
+   struct ucred   cr;
+   socklen_t      crlen = sizeof(cr);
+   H_UINT8        status = 0 == ring? HRING_NORING : 0;
+   int            fds[2];
+
+   if (0 == status && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &crlen) < 0
+         || (0 != cr.uid && cr.uid != geteuid() && cr.gid != getegid())))
+      status = HRING_REFUSED;
+   memset(&msg, 0, sizeof(msg));
+   iov.iov_base   = &status;
+   iov.iov_len    = 1;
+   msg.msg_iov    = &iov;
+   msg.msg_iovlen = 1;
+   if (0 == status) {
+      fds[0] = ringFd;
+      fds[1] = ringEfd;
+      msg.msg_control    = ctl.space;
+      msg.msg_controllen = sizeof(ctl.space);
+      cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type  = SCM_RIGHTS;
+      cm->cmsg_len   = CMSG_LEN(2 * sizeof(int));
+      memcpy(CMSG_DATA(cm), fds, 2 * sizeof(int));
+      }
+   return sendmsg(fd, &msg, MSG_NOSIGNAL) == 1? 0 : -1;
+}
+/**
+ * Refill the client rate limit bucket and return the bytes it allows now, at most
+ * max. The bucket holds one second of output, and never less than a quantum.
+ */
+static H_UINT egd_allow(   /* RETURN: bytes allowed   */
+   H_EGDCLIENT *c,         /* IN-OUT: client          */
+   double now,             /* IN: current time        */
+   H_UINT max)             /* IN: bytes wanted        */
+{
+   double cap;
+
+   if (0 == params->egd_rate)
+      return max;
+   cap = params->egd_rate < EGD_QUANTUM? EGD_QUANTUM : params->egd_rate;
+   c->tokens += (now - c->last) * params->egd_rate;
+   if (c->tokens > cap)
+      c->tokens = cap;
+   c->last = now;
+   return c->tokens < max? (H_UINT)c->tokens : max;
+}
+/**
+ * Decode the next buffered command. Replies are placed in the output buffer and
+ * reads are recorded as demand to be served by egd_client().
+ */
+static int egd_parse(      /* RETURN: bytes used, -1 bad command  */
+   H_PTR h,                /* IN: app instance                    */
+   H_EGDCLIENT *c,         /* IN-OUT: client                      */
+   double now)             /* IN: current time                    */
+{
+   H_UINT8  *p = c->ibuf;
+   H_UINT   k;
+   char     pid[16];
+
+   if (c->skip > 0) {
+      k = c->skip < c->ilen? c->skip : c->ilen;
+      c->skip -= k;
+      return k;
+      }
+   switch(p[0]) {
+      case 0x00:                                   /* entropy level     */
+         k = (egdPos < egdLen? egdLen - egdPos : h->i_readSz) * 8;
+         p = c->obuf;
+         p[0] = k >> 24;   p[1] = k >> 16;   p[2] = k >> 8;   p[3] = k;
+         c->olen = 4;
+         return 1;
+      case 0x01:                                   /* non-blocking read */
+         if (c->ilen < 2)
+            return 0;
+         k = egd_allow(c, now, p[1]);
+         c->obuf[0] = k;
+         egd_take(h, c->obuf + 1, k);
+         c->tokens -= k;
+         dstats.served += k;
+         c->olen = k + 1;
+         return 2;
+      case 0x02:                                   /* blocking read     */
+         if (c->ilen < 2)
+            return 0;
+         c->demand = p[1];
+         return 2;
+      case 0x03:                                   /* write entropy     */
+         if (c->ilen < 4)
+            return 0;
+         c->skip = p[3];
+         return 4;
+      case 0x04:                                   /* get pid           */
+         k = snprintf(pid, sizeof(pid), "%d", (int)getpid());
+         c->obuf[0] = k;
+         memcpy(c->obuf + 1, pid, k);
+         c->olen = k + 1;
+         return 1;
+      case HRING_CMD:                              /* map the ring      */
+         if (egd_ring_send(c->fd) < 0)
+            return -1;
+         return 1;
+      case EGD_BULK:                               /* bulk read         */
+         if (c->ilen < 5)
+            return 0;
+         c->demand = ((H_UINT)p[1]<<24) | ((H_UINT)p[2]<<16) | ((H_UINT)p[3]<<8) | p[4];
+         return 5;
+      }
+   return -1;
+}
+/**
+ * Advance a client by at most one quantum of output. Buffered output is sent
+ * first, then owed bytes, then the next command is decoded.
+ */
+static int egd_client(     /* RETURN: -1 close, 0 idle, 1 busy, else -ms to wait */
+   H_PTR h,                /* IN: app instance                    */
+   H_EGDCLIENT *c,         /* IN-OUT: client                      */
+   double now)             /* IN: current time                    */
+{
+   ssize_t  w;
+   int      k, want;
+
+   for(;;) {
+      if (c->opos < c->olen) {
+         w = send(c->fd, c->obuf + c->opos, c->olen - c->opos, MSG_NOSIGNAL);
+         if (w < 0)
+            return (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)? 1 : -1;
+         if ((c->opos += w) < c->olen)
+            return 1;
+         c->opos = c->olen = 0;
+         if (c->demand > 0)
+            return 1;                              /* next round        */
+         }
+      if (c->demand > 0) {
+         want = c->demand < EGD_QUANTUM? c->demand : EGD_QUANTUM;
+         k = egd_allow(c, now, want);
+         if (k < want && k < EGD_MINCHUNK)          /* wait for a useful chunk */
+            return -2 - (int)(1000.0 * ((want < EGD_MINCHUNK? want : EGD_MINCHUNK) - c->tokens) / params->egd_rate);
+         egd_take(h, c->obuf, k);
+         c->tokens -= k;
+         c->demand -= k;
+         c->olen = k;
+         dstats.served += k;
+         continue;
+         }
+      if (c->ilen == 0)
+         return 0;
+      if ((k = egd_parse(h, c, now)) < 0)
+         return -1;
+      if (k == 0)
+         return 0;
+      memmove(c->ibuf, c->ibuf + k, c->ilen -= k);
+      }
+}
+/**
+ * Drop a client
+ */
+static void egd_close(     /* RETURN: nothing         */
+   int ep,                 /* IN: epoll instance      */
+   H_EGDCLIENT **cl,       /* IN-OUT: client table    */
+   int i)                  /* IN: client index        */
+{
+   epoll_ctl(ep, EPOLL_CTL_DEL, cl[i]->fd, NULL);
+   close(cl[i]->fd);
+   free(cl[i]);
+   cl[i] = 0;
+}
+/**
+ * Set client epoll interest: input while idle, output while a write is blocked
+ */
+static void egd_interest(  /* RETURN: nothing         */
+   int ep,                 /* IN: epoll instance      */
+   H_EGDCLIENT *c,         /* IN-OUT: client          */
+   int i,                  /* IN: client index        */
+   H_UINT events)          /* IN: wanted events       */
+{
+   struct epoll_event ev;
+
+   if (events != c->events) {
+      ev.events   = events;
+      ev.data.u32 = i + 2;
+      epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+      c->events = events;
+      }
+}
+/**
+ * Serve entropy to local clients over a UNIX socket. Clients are multiplexed with
+ * epoll and served round robin, one quantum per client per round, from batched
+ * havege_rng() reads. The listener is tagged 0, the signalfd 1, clients by their
+ * table index + 2 and the ring eventfd EGD_RINGTAG. The socket is open to all
+ * local users, so no uid other than root may hold more than EGD_PERUID slots.
+ */
+static void run_egd(       /* RETURN: nothing   */
+   H_PTR h)                /* IN: app instance  */
+{
+   struct sockaddr_un   sa;
+   struct epoll_event   ev, evs[EGD_CLIENTS+2];
+   H_EGDCLIENT          *cl[EGD_CLIENTS], *c;
+   sigset_t             ctl;
+   ssize_t              r;
+   double               now;
+   int                  lfd, sfd, ep, fd, i, n, k, next = 0, timeout = -1;
+
+   if (0 != params->run_level) {
+      anchor_info(h);
+      return;
+      }
+   if (params->foreground==0)
+     daemonize();
+   else printf ("%s starting up\n", params->daemon);
+   if (0 != havege_run(h))
+      error_exit("Couldn't initialize HAVEGE rng %d", h->error);
+   if (0 != (params->verbose & H_DEBUG_INFO))
+     anchor_info(h);
+   memset(cl, 0, sizeof(cl));
+   memset(&sa, 0, sizeof(sa));
+   sa.sun_family = AF_UNIX;
+   if (strlen(params->egd_path) >= sizeof(sa.sun_path))
+      error_exit("Socket path too long: %s", params->egd_path);
+   strcpy(sa.sun_path, params->egd_path);
+   unlink(params->egd_path);
+   lfd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+   if (lfd < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(lfd, SOMAXCONN) < 0)
+      error_exit("Couldn't open socket \"%s\": %s", params->egd_path, strerror(errno));
+   chmod(params->egd_path, 0666);
+   if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+      error_exit("Couldn't create epoll instance: %s", strerror(errno));
+   ev.events   = EPOLLIN;
+   ev.data.u32 = 0;
+   epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+   sigemptyset(&ctl);
+   sigaddset(&ctl, SIGUSR1);
+   sigaddset(&ctl, SIGHUP);
+   sigprocmask(SIG_BLOCK, &ctl, NULL);
+   if ((sfd = signalfd(-1, &ctl, SFD_NONBLOCK|SFD_CLOEXEC)) >= 0) {
+      ev.data.u32 = 1;
+      epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &ev);
+      }
+   if (0 != params->ring_kb) {
+      egd_ring_create(params->ring_kb);
+      ev.data.u32 = EGD_RINGTAG;
+      epoll_ctl(ep, EPOLL_CTL_ADD, ringEfd, &ev);
+      egd_ring_fill(h);
+      }
+   for(;;) {
+      if ((n = epoll_wait(ep, evs, EGD_CLIENTS+2, timeout)) < 0) {
+         if (errno != EINTR)
+            error_exit("epoll error: %s", strerror(errno));
+         continue;
+         }
+      dstats.wakeups += 1;
+      budget_charge();
+      for(i=0;i<n;i++) {
+         if (evs[i].data.u32 == 0) {
+            while((fd = accept(lfd, NULL, NULL)) >= 0) {
+               struct ucred   cr;
+               socklen_t      crlen = sizeof(cr);
+               int            same;
+
+               fcntl(fd, F_SETFL, O_NONBLOCK);
+               fcntl(fd, F_SETFD, FD_CLOEXEC);
+               if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &crlen) < 0) {
+                  close(fd);
+                  continue;
+                  }
+               for(k=same=0;k<EGD_CLIENTS;k++)
+                  if (0 != cl[k] && cl[k]->uid == cr.uid)
+                     same += 1;
+               if (0 != cr.uid && same >= EGD_PERUID) {
+                  dstats.refused += 1;
+                  close(fd);
+                  continue;
+                  }
+               for(k=0;k<EGD_CLIENTS && 0 != cl[k];k++);
+               if (k == EGD_CLIENTS || NULL == (c = calloc(1, sizeof(H_EGDCLIENT)))) {
+                  close(fd);
+                  continue;
+                  }
+               c->fd     = fd;
+               c->uid    = cr.uid;
+               c->events = EPOLLIN;
+               c->last   = daemon_now();
+               ev.events   = EPOLLIN;
+               ev.data.u32 = k + 2;
+               epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+               cl[k] = c;
+               dstats.clients += 1;
+               }
+            }
+         else if (evs[i].data.u32 == 1) {
+            struct signalfd_siginfo si;
+
+            while(read(sfd, &si, sizeof(si)) == sizeof(si))
+               if (si.ssi_signo == SIGHUP)
+                  daemon_reload(h);
+               else daemon_info(h);
+            }
+         else if (evs[i].data.u32 == EGD_RINGTAG) {
+            uint64_t u;
+
+            if (read(ringEfd, &u, sizeof(u)) == sizeof(u))
+               egd_ring_fill(h);
+            }
+         else if (0 != (c = cl[k = evs[i].data.u32 - 2])) {
+            if (0 != (evs[i].events & EPOLLIN) && c->ilen < EGD_CMDSZ) {
+               r = read(c->fd, c->ibuf + c->ilen, EGD_CMDSZ - c->ilen);
+               if (r > 0)
+                  c->ilen += r;
+               else if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+                  egd_close(ep, cl, k);
+                  continue;
+                  }
+               }
+            if (0 != (evs[i].events & (EPOLLERR|EPOLLHUP)) && 0 == (evs[i].events & EPOLLIN))
+               egd_close(ep, cl, k);
+            }
+         }
+      /* one round over the clients, starting one further along each time */
+      now = daemon_now();
+      timeout = -1;
+      for(i=0;i<EGD_CLIENTS;i++) {
+         k = (next + i) % EGD_CLIENTS;
+         if (0 == (c = cl[k]))
+            continue;
+         switch(n = egd_client(h, c, now)) {
+            case -1:
+               egd_close(ep, cl, k);
+               break;
+            case 0:
+               egd_interest(ep, c, k, c->ilen < EGD_CMDSZ? EPOLLIN : 0);
+               break;
+            case 1:
+               if (c->opos < c->olen)
+                  egd_interest(ep, c, k, EPOLLOUT);
+               else {
+                  egd_interest(ep, c, k, 0);
+                  timeout = 0;
+                  }
+               break;
+            default:
+               egd_interest(ep, c, k, 0);
+               n = -2 - n;
+               if (timeout < 0 || n < timeout)
+                  timeout = n < 1? 1 : n;
+            }
+         }
+      next = (next + 1) % EGD_CLIENTS;
+      }
 }
 /**
  * Set random write threshold
@@ -994,13 +2375,261 @@ void read_char(void)
 	
 }
 
+#ifdef __ANDROID__
+/**
+ * Interactive governor tunables, written globally and for each policy
+ */
+static const char *govTunables[][2] = {
+   {"above_hispeed_delay", "20000"},   {"boost", "0"},
+   {"boostpulse_duration", "80000"},   {"boosttop_duration", "80000"},
+   {"go_highspeed_load", "99"},        {"go_maxspeed_load", "99"},
+   {"input_dev_monitor", "1"},         {"input_boost", "1"},
+   {"io_is_busy", "0"},                {"min_sample_time", "80000"},
+   {"target_loads", "90"},             {"target_load", "90"},
+   {"sustain_load", "90"},             {"timer_rate", "20000"},
+   {"timer_slack", "80000"}
+   };
+static char    **govPolicy = NULL;
+static H_UINT  govPolicies = 0;
+static TOPO_MAP govOnline;
+/**
+ * The writer is used by the screen sleep thread and reported by the daemon loop,
+ * sysfsLock is held while either walks the nodes.
+ */
+static H_SYSFS sysfs;
+static pthread_mutex_t sysfsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int  sysfs_put(const char *path, const char *value);
+/**
+ * Keep the online cpu map found by tuning. Called by the daemon before the screen
+ * sleep thread starts, which then never looks at the instance.
+ */
+static void governor_online(  /* RETURN: nothing   */
+   H_PTR h)                   /* IN: app instance  */
+{
+   HOST_CFG *env = NULL != h? (HOST_CFG *) h->tuneData : NULL;
+
+   memset(&govOnline, 0, sizeof(TOPO_MAP));
+   if (NULL != env)
+      memcpy(&govOnline, &env->pOnline, sizeof(TOPO_MAP));
+}
+/**
+ * Find the cpufreq policies of the online cpus. The online map is the one kept
+ * from tuning, or read here when tuning was bypassed. Cpus that share a policy
+ * link to the same directory, so each policy is written once however many cpus
+ * it covers.
+ */
+static void governor_topology(   /* RETURN: nothing   */
+   void)                         /* IN: nothing       */
+{
+   TOPO_MAP    online;
+   FILE        *f;
+   char        path[64], real[PATH_MAX];
+   int         cpu, lo, hi, n, max = MAX_BIT_IDX * BITS_PER_H_UINT;
+   H_UINT      i;
+
+   memcpy(&online, &govOnline, sizeof(TOPO_MAP));
+   for(i=0;i<MAX_BIT_IDX && 0 == online.bits[i];i++);
+   if (i == MAX_BIT_IDX && NULL != (f = fopen("/sys/devices/system/cpu/online", "r"))) {
+      while((n = fscanf(f, "%d-%d", &lo, &hi)) >= 1) {
+         if (n == 1)
+            hi = lo;
+         for(cpu = lo;cpu <= hi && cpu < max;cpu++)
+            online.bits[cpu / BITS_PER_H_UINT] |= 1U << (cpu % BITS_PER_H_UINT);
+         if (fgetc(f) != ',')
+            break;
+         }
+      fclose(f);
+      }
+   if (NULL == (govPolicy = calloc(max, sizeof(char *))))
+      return;
+   for(cpu = 0;cpu < max;cpu++) {
+      if (0 == (online.bits[cpu / BITS_PER_H_UINT] & 1U << (cpu % BITS_PER_H_UINT)))
+         continue;
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq", cpu);
+      if (NULL == realpath(path, real))
+         continue;
+      for(i=0;i<govPolicies && strcmp(govPolicy[i], real) != 0;i++);
+      if (i == govPolicies && NULL != (govPolicy[i] = strdup(real)))
+         govPolicies += 1;
+      }
+}
+/**
+ * Switch every policy to a governor. A switch recreates the governor tunables,
+ * so the cached interactive nodes are dropped before the tunables are written.
+ * The policies are found by governor_topology() before the screen sleep thread
+ * starts, so a suspend of the collector never races the lookup. Each call starts
+ * a pass in which every node is written again, whatever was written before.
+ */
+static void governor_set(     /* RETURN: nothing      */
+   const char *governor)      /* IN: governor name    */
+{
+   char     path[PATH_MAX + 64];
+   H_UINT   i, j, n = 0;
+
+   sysfs_stale();
+   for(i=0;i<govPolicies;i++) {
+      snprintf(path, sizeof(path), "%s/scaling_governor", govPolicy[i]);
+      n += sysfs_set(path, governor);
+      }
+   if (n != 0)
+      sysfs_forget("/interactive/");
+   if (strcmp(governor, "interactive") != 0)
+      return;
+   for(j=0;j<sizeof(govTunables)/sizeof(govTunables[0]);j++) {
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpufreq/interactive/%s", govTunables[j][0]);
+      sysfs_set(path, govTunables[j][1]);
+      for(i=0;i<govPolicies;i++) {
+         snprintf(path, sizeof(path), "%s/interactive/%s", govPolicy[i], govTunables[j][0]);
+         sysfs_set(path, govTunables[j][1]);
+         }
+      }
+}
+/**
+ * Close the nodes whose path contains pattern, they are opened again on next use
+ */
+static void sysfs_forget(     /* RETURN: nothing      */
+   const char *pattern)       /* IN: path fragment    */
+{
+   H_SYSNODE   *p;
+   H_UINT      i;
+
+   pthread_mutex_lock(&sysfsLock);
+   for(i=0;i<sysfs.n;i++) {
+      p = sysfs.node + i;
+      if (NULL == strstr(p->path, pattern))
+         continue;
+      if (p->fd >= 0)
+         close(p->fd);
+      p->fd      = -1;
+      p->absent  = 0;
+      p->last[0] = 0;
+      }
+   pthread_mutex_unlock(&sysfsLock);
+}
+/**
+ * Drop the last values written. Another writer may have changed a node since,
+ * so a pass must not skip a value only because it was written in an earlier one.
+ */
+static void sysfs_stale(      /* RETURN: nothing      */
+   void)                      /* IN: nothing          */
+{
+   H_UINT      i;
+
+   pthread_mutex_lock(&sysfsLock);
+   for(i=0;i<sysfs.n;i++)
+      sysfs.node[i].last[0] = 0;
+   pthread_mutex_unlock(&sysfsLock);
+}
+/**
+ * Report the writer statistics
+ */
+static int sysfs_info(        /* RETURN: length       */
+   char *out,                 /* OUT: "name value" lines */
+   int len)                   /* IN: space            */
+{
+   H_UINT   i, open = 0, absent = 0;
+   int      n;
+
+   pthread_mutex_lock(&sysfsLock);
+   for(i=0;i<sysfs.n;i++) {
+      open   += sysfs.node[i].fd >= 0;
+      absent += sysfs.node[i].absent;
+      }
+   n = snprintf(out, len,
+      "sysfs_policies %u\nsysfs_nodes %u\nsysfs_open %u\nsysfs_missing %u\nsysfs_opens %u\n"
+      "sysfs_writes %u\nsysfs_skipped %u\nsysfs_failures %u\nsysfs_usecs_mean %.1f\nsysfs_usecs_max %.1f\n",
+      govPolicies, sysfs.n, open, absent, sysfs.opens, sysfs.writes, sysfs.skipped, sysfs.fails,
+      sysfs.writes? sysfs.usecs / sysfs.writes : 0.0, sysfs.maxUsecs);
+   pthread_mutex_unlock(&sysfsLock);
+   return n;
+}
+/**
+ * Write a value to a node. The node is opened on first use and kept open, a
+ * node that cannot be opened is not tried again until it is forgotten, and a
+ * value equal to the last one written in the same pass is skipped.
+ */
+static int sysfs_set(         /* RETURN: 1 if written */
+   const char *path,          /* IN: node path        */
+   const char *value)         /* IN: value            */
+{
+   int   r;
+
+   pthread_mutex_lock(&sysfsLock);
+   r = sysfs_put(path, value);
+   pthread_mutex_unlock(&sysfsLock);
+   return r;
+}
+/**
+ * The body of sysfs_set(), called with sysfsLock held
+ */
+static int sysfs_put(         /* RETURN: 1 if written */
+   const char *path,          /* IN: node path        */
+   const char *value)         /* IN: value            */
+{
+   H_SYSNODE   *p = NULL;
+   char        buf[SYSFS_VALSZ + 1];
+   double      t;
+   H_UINT      i;
+   int         n, r;
+
+   for(i=0;i<sysfs.n;i++)
+      if (strcmp(sysfs.node[i].path, path) == 0) {
+         p = sysfs.node + i;
+         break;
+         }
+   if (NULL == p) {
+      if (sysfs.n == sysfs.max) {
+         if (NULL == (p = realloc(sysfs.node, (sysfs.max + 32) * sizeof(H_SYSNODE))))
+            return 0;
+         sysfs.node = p;
+         sysfs.max += 32;
+         }
+      p = sysfs.node + sysfs.n;
+      memset(p, 0, sizeof(H_SYSNODE));
+      if (NULL == (p->path = strdup(path)))
+         return 0;
+      p->fd = -1;
+      sysfs.n += 1;
+      }
+   if (0 != p->absent || (n = snprintf(buf, sizeof(buf), "%s\n", value)) >= (int)sizeof(buf))
+      return 0;
+   if (p->fd >= 0 && strcmp(p->last, value) == 0) {
+      sysfs.skipped += 1;
+      return 0;
+      }
+   t = daemon_now();
+   if (p->fd < 0) {
+      sysfs.opens += 1;
+      if ((p->fd = open(path, O_WRONLY|O_CLOEXEC)) < 0) {
+         p->absent = 1;
+         return 0;
+         }
+      }
+   r = pwrite(p->fd, buf, n, 0);
+   t = (daemon_now() - t) * 1e6;
+   sysfs.writes += 1;
+   sysfs.usecs  += t;
+   if (t > sysfs.maxUsecs)
+      sysfs.maxUsecs = t;
+   if (r != n) {
+      if (0 == p->fails++)
+         print_msg("sysfs: %s: %s\n", path, r < 0? strerror(errno) : "short write");
+      sysfs.fails += 1;
+      p->last[0]   = 0;
+      return 0;
+      }
+   strcpy(p->last, value);
+   return 1;
+}
+#endif
 #endif
 /**
  * Display handle information
  */
 static void anchor_info(H_PTR h)
 {
-   char       buf[120];
+   char       buf[240];
    H_SD_TOPIC topics[4] = {H_SD_TOPIC_BUILD, H_SD_TOPIC_TUNE, H_SD_TOPIC_TEST, H_SD_TOPIC_SUM};
    int        i;
    
@@ -1103,6 +2732,183 @@ static int injectFile(     /* RETURN: not used  */
    return 0;
 }
 #endif
+/**
+ * Writer thread state for the output engine
+ */
+#if NUMBER_CORES>1
+static struct {
+   pthread_t       thread;       /* the writer                 */
+   pthread_mutex_t lock;         /* protects fields below      */
+   pthread_cond_t  cond;         /* buffer queued or written   */
+   H_UINT          head;         /* next buffer to write       */
+   H_UINT          count;        /* buffers queued             */
+   H_UINT          stop;         /* no more buffers            */
+   int             err;          /* errno of failed write      */
+} outq;
+/**
+ * Write queued buffers until told to stop
+ */
+static void *out_writer(   /* RETURN: nothing         */
+   void *arg)              /* IN: output engine       */
+{
+   H_OUTPUT *o = (H_OUTPUT *)arg;
+   H_UINT   k;
+   int      err;
+
+   pthread_mutex_lock(&outq.lock);
+   for(;;) {
+      while(0==outq.count && 0==outq.stop)
+         pthread_cond_wait(&outq.cond, &outq.lock);
+      if (0==outq.count)
+         break;
+      k = outq.head;
+      pthread_mutex_unlock(&outq.lock);
+      err = out_write(o->fd, o->buf[k], o->len[k]);
+      pthread_mutex_lock(&outq.lock);
+      outq.head = (k + 1) % o->nBufs;
+      outq.count -= 1;
+      if (0 != err) {
+         outq.err = err;
+         outq.count = 0;
+         }
+      pthread_cond_broadcast(&outq.cond);
+      if (0 != err)
+         break;
+      }
+   pthread_mutex_unlock(&outq.lock);
+   return NULL;
+}
+#endif
+/**
+ * Flush and release the output engine
+ */
+static void out_close(     /* RETURN: nothing         */
+   H_OUTPUT *o)            /* IN: output engine       */
+{
+#if NUMBER_CORES>1
+   if (o->mode == OUT_THREAD) {
+      pthread_mutex_lock(&outq.lock);
+      outq.stop = 1;
+      pthread_cond_broadcast(&outq.cond);
+      pthread_mutex_unlock(&outq.lock);
+      pthread_join(outq.thread, NULL);
+      if (0 != outq.err)
+         error_exit("Cannot write data in file: %s", strerror(outq.err));
+      }
+#endif
+   if (o->fd != STDOUT_FILENO && close(o->fd) < 0)
+      error_exit("Cannot write data in file: %s", strerror(errno));
+}
+/**
+ * Return the next buffer to fill. With a writer thread this waits until the
+ * buffer has been written.
+ */
+static H_UINT8 *out_get(   /* RETURN: buffer          */
+   H_OUTPUT *o)            /* IN: output engine       */
+{
+#if NUMBER_CORES>1
+   if (o->mode == OUT_THREAD) {
+      pthread_mutex_lock(&outq.lock);
+      while(outq.count == o->nBufs && 0 == outq.err)
+         pthread_cond_wait(&outq.cond, &outq.lock);
+      pthread_mutex_unlock(&outq.lock);
+      if (0 != outq.err)
+         error_exit("Cannot write data in file: %s", strerror(outq.err));
+      }
+#endif
+   return o->buf[o->next];
+}
+/**
+ * Carve the output buffers from the io buffer and pick how they are drained.
+ * A writer thread drains the buffers when threads are built in, and output is
+ * written in line when they are not. Buffers are always copied out by write(),
+ * pages lent to a pipe would still be referenced by the reader when they are
+ * refilled. A pipe is resized to one buffer so each write moves a full buffer.
+ */
+static void out_open(      /* RETURN: nothing         */
+   H_PTR h,                /* IN: app instance        */
+   H_OUTPUT *o)            /* IN-OUT: output engine   */
+{
+   size_t   page = sysconf(_SC_PAGESIZE);
+   H_UINT8  *p = (H_UINT8 *)(((size_t)h->io_buf + page - 1) & ~(page - 1));
+   H_UINT   i;
+
+   o->mode  = OUT_WRITE;
+   o->nBufs = params->out_bufs;
+   o->bufSz = (size_t)params->out_kb * 1024;
+   o->next  = 0;
+   for(i=0;i<o->nBufs;i++)
+      o->buf[i] = p + i * o->bufSz;
+#if defined(F_SETPIPE_SZ)
+   {
+      struct stat st;
+
+      if (fstat(o->fd, &st) == 0 && S_ISFIFO(st.st_mode))
+         (void)fcntl(o->fd, F_SETPIPE_SZ, o->bufSz);
+   }
+#endif
+   if (o->nBufs < 2)
+      return;
+#if NUMBER_CORES>1
+   memset(&outq, 0, sizeof(outq));
+   pthread_mutex_init(&outq.lock, NULL);
+   pthread_cond_init(&outq.cond, NULL);
+   if (0 == pthread_create(&outq.thread, NULL, out_writer, o))
+      o->mode = OUT_THREAD;
+#endif
+}
+/**
+ * Hand the filled buffer to the output and move on to the next
+ */
+static void out_put(       /* RETURN: nothing         */
+   H_OUTPUT *o,            /* IN: output engine       */
+   size_t n)               /* IN: bytes to output     */
+{
+   H_UINT8  *p = o->buf[o->next];
+   int      err = 0;
+
+   switch(o->mode) {
+#if NUMBER_CORES>1
+      case OUT_THREAD:
+         pthread_mutex_lock(&outq.lock);
+         o->len[o->next] = n;
+         outq.count += 1;
+         pthread_cond_broadcast(&outq.cond);
+         pthread_mutex_unlock(&outq.lock);
+         break;
+#endif
+      default:
+         err = out_write(o->fd, p, n);
+      }
+   if (0 != err)
+      error_exit("Cannot write data in file: %s", strerror(err));
+   o->next = (o->next + 1) % o->nBufs;
+}
+/**
+ * Write a buffer in full
+ */
+static int out_write(      /* RETURN: 0 or errno      */
+   int fd,                 /* IN: output descriptor   */
+   H_UINT8 *p,             /* IN: data                */
+   size_t n)               /* IN: bytes to write      */
+{
+   struct pollfd  pfd;
+   ssize_t        r;
+
+   pfd.fd     = fd;
+   pfd.events = POLLOUT;
+   while(n > 0) {
+      if ((r = write(fd, p, n)) >= 0) {
+         p += r;
+         n -= r;
+         }
+      else if (errno == EAGAIN)
+         (void)poll(&pfd, 1, -1);
+      else if (errno != EINTR)
+         return errno;
+      }
+   return 0;
+}
 /**
  * Pretty print the collection size
  */
@@ -1150,21 +2956,23 @@ static void run_app(       /* RETURN: nothing         */
    H_UINT bufct,           /* IN: # buffers to fill   */
    H_UINT bufres)          /* IN: # bytes extra       */
 {
-   H_UINT   *buffer;
-   FILE     *fout = NULL;
-   H_UINT    ct=0;
-   int       limits = bufct;
+   H_OUTPUT  out;
+   H_UINT8   *buffer;
+   char      sbuf[32];
+   unsigned long long remain;
+   size_t    n;
+   int       limits;
 
    if (0 != havege_run(h))
       error_exit("Couldn't initialize HAVEGE rng %d", h->error);
    if (0 != (params->setup & USE_STDOUT)) {
       params->sample_out = "stdout";
-      fout = stdout;
+      out.fd = STDOUT_FILENO;
       }
-   else if (!(fout = fopen (params->sample_out, "wb")))
+   else if ((out.fd = open(params->sample_out, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
       error_exit("Cannot open file <%s> for writing.\n", params->sample_out);
    limits = bufct!=0? 1 : bufres != 0;
-   buffer = (H_UINT *)h->io_buf;
+   remain = (unsigned long long)bufct * APP_BUFF_SIZE * sizeof(H_UINT) + bufres;
 #ifdef RAW_IN_ENABLE
    {
       char *format, *in="",*out,*sz,*src="";
@@ -1179,34 +2987,149 @@ static void run_app(       /* RETURN: nothing         */
          }
       else format = "Writing %s%s%s bytes to %s\n";
       if (limits)
-         sz = ppSize((char *)buffer, (1.0 * bufct) * APP_BUFF_SIZE * sizeof(H_UINT) + bufres);
+         sz = ppSize(sbuf, (double)remain);
       else sz = "unlimited";
-      out = (fout==stdout)? "stdout" : params->sample_out;
+      out = (0==(params->setup & USE_STDOUT))? params->sample_out : "stdout";
       fprintf(stderr, format, in, src, sz, out);
    }  
 #else
    if (limits)
-      fprintf(stderr, "Writing %s output to %s\n",
-         ppSize((char *)buffer, (1.0 * bufct) * APP_BUFF_SIZE * sizeof(H_UINT) + bufres), params->sample_out);
+      fprintf(stderr, "Writing %s output to %s\n", ppSize(sbuf, (double)remain), params->sample_out);
    else fprintf(stderr, "Writing unlimited bytes to stdout\n");
 #endif
-   while(!limits || ct++ < bufct) {
-      if (havege_rng(h, buffer, APP_BUFF_SIZE)<1)
-         error_exit("RNG failed %d!", h->error);
-      if (fwrite (buffer, 1, APP_BUFF_SIZE * sizeof(H_UINT), fout) == 0)
-         error_exit("Cannot write data in file: %s", strerror(errno));
-   }
-   ct = (bufres + sizeof(H_UINT) - 1)/sizeof(H_UINT);
-   if (ct) {
-      if (havege_rng(h, buffer, ct)<1)
+   out_open(h, &out);
+   while(!limits || remain > 0) {
+      n = out.bufSz;
+      if (limits && remain < n)
+         n = (size_t)remain;
+      buffer = out_get(&out);
+      if (havege_rng(h, (H_UINT *)buffer, (n + sizeof(H_UINT) - 1)/sizeof(H_UINT))<1)
          error_exit("RNG failed %d!", h->error);
-      if (fwrite (buffer, 1, bufres, fout) == 0)
-         error_exit("Cannot write data in file: %s", strerror(errno));
+      out_put(&out, n);
+      remain -= n;
       }
-   fclose(fout);
+   out_close(&out);
    if (0 != (params->verbose & H_DEBUG_INFO))
       anchor_info(h);
 }
+/**
+ * Generate one shard of the output in a child process. Each shard has its own
+ * collector and online tests and writes its own region of the output with
+ * pwrite, so shards never contend for anything but the disk.
+ */
+static void run_shard(     /* RETURN: does not return */
+   H_PARAMS *cmd,          /* IN: collector setup     */
+   H_UINT id,              /* IN: shard number        */
+   unsigned long long offs,/* IN: offset of region    */
+   unsigned long long sz)  /* IN: bytes in region     */
+{
+   static char name[32];
+   char        path[4096];
+   H_UINT8     *buffer, *p;
+   size_t      bufSz = (size_t)params->out_kb * 1024, page = sysconf(_SC_PAGESIZE), n;
+   ssize_t     r;
+   int         fd, flags = O_WRONLY;
+
+   shardCt = 0;
+   snprintf(name, sizeof(name), "%s[%u]", params->daemon, id);
+   params->daemon = name;
+   handle = havege_create(cmd);
+   if (NULL == handle || H_NOERR != handle->error)
+      error_exit("Couldn't initialize haveged (%d)", handle==NULL? H_NOHANDLE : handle->error);
+   if (0 != havege_run(handle))
+      error_exit("Couldn't initialize HAVEGE rng %d", handle->error);
+   if (0 != params->shard_split) {
+      if (snprintf(path, sizeof(path), "%s.%u", params->sample_out, id) >= (int)sizeof(path))
+         error_exit("Shard path too long");
+      flags |= O_CREAT|O_TRUNC;
+      offs = 0;
+      }
+   else strcpy(path, params->sample_out);
+   if ((fd = open(path, flags, 0666)) < 0)
+      error_exit("Cannot open file <%s> for writing.\n", path);
+   buffer = (H_UINT8 *)(((size_t)handle->io_buf + page - 1) & ~(page - 1));
+   while(sz > 0) {
+      n = sz < bufSz? (size_t)sz : bufSz;
+      if (havege_rng(handle, (H_UINT *)buffer, (n + sizeof(H_UINT) - 1)/sizeof(H_UINT))<1)
+         error_exit("RNG failed %d!", handle->error);
+      sz -= n;
+      for(p = buffer;n > 0;) {
+         if ((r = pwrite(fd, p, n, offs)) < 0) {
+            if (errno == EINTR)
+               continue;
+            error_exit("Cannot write data in file: %s", strerror(errno));
+            }
+         p += r;
+         offs += r;
+         n -= r;
+         }
+      }
+   if (close(fd) < 0)
+      error_exit("Cannot write data in file: %s", strerror(errno));
+   if (0 != (params->verbose & H_DEBUG_INFO))
+      anchor_info(handle);
+   havege_destroy(handle);
+   exit(0);
+}
+/**
+ * Split the output between shards and wait for them. Shards start on a page
+ * boundary so every pwrite is page aligned.
+ */
+static void run_shards(    /* RETURN: does not return */
+   H_PARAMS *cmd,          /* IN: collector setup     */
+   H_UINT bufct,           /* IN: # buffers to fill   */
+   H_UINT bufres)          /* IN: # bytes extra       */
+{
+   unsigned long long total, share, offs;
+   char     sbuf[32];
+   H_UINT   i;
+   pid_t    pid;
+   int      fd, status;
+
+   if (0 == (params->setup & RANGE_SPEC) || 0 != (params->setup & USE_STDOUT))
+      error_exit("shards need --number and an output file");
+   if (0 != (cmd->options & (H_DEBUG_RAW_OUT|H_DEBUG_RAW_IN|H_DEBUG_TEST_IN)))
+      error_exit("shards cannot be used for diagnostics");
+   total = (unsigned long long)bufct * APP_BUFF_SIZE * sizeof(H_UINT) + bufres;
+   share = (total + params->shards - 1) / params->shards;
+   share = (share + 4095) & ~4095ULL;
+   cmd->nCores = 1;
+   if (0 == params->shard_split) {
+      if ((fd = open(params->sample_out, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
+         error_exit("Cannot open file <%s> for writing.\n", params->sample_out);
+      if (ftruncate(fd, total) < 0 || close(fd) < 0)
+         error_exit("Cannot size file <%s>: %s", params->sample_out, strerror(errno));
+      }
+   fprintf(stderr, "Writing %s output to %s%s in %u shards\n", ppSize(sbuf, (double)total),
+      params->sample_out, params->shard_split? ".<n>" : "", (H_UINT)((total + share - 1) / share));
+   for(offs=0;offs<total;offs+=share) {
+      switch(pid = fork()) {
+         case 0:
+            run_shard(cmd, shardCt, offs, total - offs < share? total - offs : share);
+            break;
+         case -1:
+            error_exit("Cannot fork shard %u", shardCt);
+            break;
+         default:
+            shardPids[shardCt++] = pid;
+         }
+      }
+   for(i=0;i<shardCt;) {
+      if ((pid = wait(&status)) < 0) {
+         if (errno == EINTR)
+            continue;
+         break;
+         }
+      i += 1;
+      if (!WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+         for(i=0;i<shardCt;i++)
+            kill(shardPids[i], SIGTERM);
+         shardCt = 0;
+         error_exit("Shard writer %d failed", (int)pid);
+         }
+      }
+   exit(0);
+}
 /**
  * Show collection info.
  */
@@ -1235,6 +3158,14 @@ static void show_meterInfo(      /* RETURN: nothing   */
 static void tidy_exit(           /* OUT: nothing      */
    int signum)                   /* IN: signal number */
 {
+  H_UINT i;
+
+  for(i=0;i<shardCt;i++)
+     kill(shardPids[i], signum);
+#ifndef NO_DAEMON
+  if (resumePid > 0)
+     kill(resumePid, SIGKILL);
+#endif
   params->exit_code = 128 + signum;
   error_exit("Stopping due to signal %d\n", signum);
 }
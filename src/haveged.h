@@ -45,11 +45,30 @@ struct pparams  {
    H_UINT         verbose;          /* Output level for log or stdout               */
    char           *version;         /* Our version                                  */
    char           *watermark;       /* path to write_wakeup_threshold               */
+   char           *egd_path;        /* path of EGD socket - 0 for none              */
+   H_UINT         egd_rate;         /* EGD per client limit (bytes/s) - 0 for none  */
+   H_UINT         ring_kb;          /* EGD shared memory ring size (kb) - 0 for none*/
+   H_UINT         out_bufs;         /* output buffers in flight                     */
+   H_UINT         out_kb;           /* size of each output buffer (kb)              */
+   H_UINT         shards;           /* parallel output shards - 0 for none          */
+   H_UINT         shard_split;      /* non-zero to write each shard to its own file */
+   char           *ctl_path;        /* path of control socket - 0 for none          */
+   char           *cfg_path;        /* settings file read on SIGHUP - 0 for none    */
+   int            handoff_fd;       /* supervisor state descriptor - -1 for none    */
+   H_UINT         sched_low;        /* pool bits to leave SCHED_IDLE - 0 for none   */
+   int            sched_nice;       /* nice value outside SCHED_IDLE                */
+   double         budget_pct;       /* collector cpu budget, % of a core - 0 for none*/
+   H_UINT         budget_secs;      /* budget averaging window (seconds)            */
   };
 /**
  * Buffer size used when not running as daemon
  */
 #define   APP_BUFF_SIZE    1024
+#define   OUT_BUFS         4
+#define   OUT_KB           1024
+#define   OUT_MAXBUFS      64
+#define   OUT_MAXMB        1024     /* limit on all output buffers together */
+#define   OUT_MAXSHARDS    256
 #define   INPUT_DEFAULT    "data"
 #define   OUTPUT_DEFAULT   "sample"
 #define   PID_DEFAULT      "/dev/haveged.pid"
@@ -64,6 +83,7 @@ struct pparams  {
 #define   RUN_IN_FG     0x020
 #define   SET_LWM       0x040
 #define   MULTI_CORE    0x080
+#define   USE_EGD       0x100
 /**
  * Default tests settings
  */
@@ -83,5 +103,202 @@ typedef struct {
    double         etime;            /* milliseconds for last collection */
    double         estart;           /* start time for calculation       */
 } H_METER;
+/**
+ * Daemon loop statistics
+ */
+typedef struct {
+   H_UINT         wakeups;          /* number of times poll() returned  */
+   H_UINT         injections;       /* number of RNDADDENTROPY calls    */
+   H_UINT         early;            /* injections ahead of a drain      */
+   H_UINT         clients;          /* EGD clients accepted             */
+   H_UINT         refused;          /* EGD clients over the uid cap     */
+   H_UINT         timeouts;         /* forecast timer wakeups           */
+   H_UINT         ioerrs;           /* failed random device ioctls      */
+   H_UINT         ent_last;         /* last RNDGETENTCNT sample         */
+   H_UINT         ent_min;          /* lowest RNDGETENTCNT sample       */
+   H_UINT         ent_n;            /* RNDGETENTCNT samples             */
+   double         ent_sum;          /* sum of RNDGETENTCNT samples      */
+   double         injected;         /* bytes added to the pool          */
+   double         served;           /* bytes served to EGD clients      */
+   double         rate;             /* forecast demand, bits/second     */
+   double         ferr;             /* mean forecast error, bits        */
+   double         start;            /* time the loop started, seconds   */
+} H_DSTATS;
+/**
+ * Control socket. Clients send one command per line and each reply ends with
+ * a line of "ok" or "error <reason>".
+ */
+#define  CTL_CLIENTS    4           /* connected control clients        */
+#define  CTL_LINESZ     256         /* longest command line             */
+#define  CTL_PFD        4           /* poll slot of first client        */
+
+typedef struct {
+   H_UINT         ilen;             /* command bytes buffered           */
+   char           ibuf[CTL_LINESZ]; /* command input                    */
+} H_CTLCLIENT;
+/**
+ * EGD socket service. Commands 0-4 are the EGD protocol, EGD_BULK is followed by
+ * a 4 byte big endian count and answered with that many bytes.
+ */
+#define  EGD_BUFSZ      (64*1024*sizeof(H_UINT))   /* batch size of rng reads */
+#define  EGD_CLIENTS    64          /* maximum connected clients        */
+#define  EGD_PERUID     8           /* clients per uid other than root  */
+#define  EGD_QUANTUM    16384       /* bytes per client per round       */
+#define  EGD_MINCHUNK   1024        /* smallest rate limited send       */
+#define  EGD_CMDSZ      64          /* command input buffer             */
+#define  EGD_BULK       0x10        /* bulk binary read command         */
+#define  EGD_RINGTAG    0xffff      /* epoll tag of the ring eventfd    */
+
+typedef struct {
+   int            fd;               /* client socket                    */
+   uid_t          uid;              /* peer uid from SO_PEERCRED        */
+   H_UINT         events;           /* epoll interest                   */
+   H_UINT         ilen;             /* command bytes buffered           */
+   H_UINT         skip;             /* write command bytes to discard   */
+   H_UINT         demand;           /* bytes owed to the client         */
+   H_UINT         opos;             /* next output byte to send         */
+   H_UINT         olen;             /* output bytes buffered            */
+   double         tokens;           /* rate limit bucket, bytes         */
+   double         last;             /* time of last bucket refill       */
+   H_UINT8        ibuf[EGD_CMDSZ];  /* command input                    */
+   H_UINT8        obuf[EGD_QUANTUM];/* response output                  */
+} H_EGDCLIENT;
+/**
+ * Output engine for application runs. One buffer is filled while the others
+ * drain on a writer thread. Builds without threads write each buffer in line.
+ */
+#define  OUT_WRITE      0           /* write in line                    */
+#define  OUT_THREAD     1           /* write on a writer thread         */
+
+typedef struct {
+   int            fd;               /* output descriptor                */
+   int            mode;             /* one of the OUT_ modes above      */
+   H_UINT         nBufs;            /* buffers in rotation              */
+   H_UINT         next;             /* next buffer to fill              */
+   size_t         bufSz;            /* bytes per buffer                 */
+   H_UINT8        *buf[OUT_MAXBUFS];/* page aligned buffers in io_buf   */
+   size_t         len[OUT_MAXBUFS]; /* bytes queued in each buffer      */
+} H_OUTPUT;
+/**
+ * Warm restart state. A supervisor such as cb_runhaveged creates the state in a
+ * memfd and passes the descriptor to each daemon it starts (-H). The daemon
+ * stores its tuning there and quarantines a reserve of tested output that only
+ * the next daemon injects, once, while its own collector warms up. The
+ * supervisor fields record the restart history.
+ */
+#define  HANDOFF_MAGIC     0x48484f46        /* "HHOF"                       */
+#define  HANDOFF_VERSION   1
+#define  HANDOFF_RESERVE   4096              /* bytes of quarantined output  */
+
+typedef struct {
+   H_UINT         magic;            /* HANDOFF_MAGIC                    */
+   H_UINT         version;          /* HANDOFF_VERSION                  */
+   H_UINT         restarts;         /* supervisor: daemons started      */
+   int            last_status;      /* supervisor: wait status of last  */
+   double         last_start;       /* supervisor: daemon start, secs   */
+   double         last_uptime;      /* supervisor: last daemon run secs */
+   double         resume_ms;        /* daemon: start to first injection */
+   double         warm_ms;          /* daemon: start to collector ready */
+   H_UINT         resumed;          /* daemon: reserve bytes injected   */
+   H_UINT         d_cache;          /* daemon: tuned data cache KB      */
+   H_UINT         i_cache;          /* daemon: tuned instruction KB     */
+   volatile H_UINT held;            /* reserve bytes held               */
+   H_UINT8        reserve[HANDOFF_RESERVE];
+} H_HANDOFF;
+/**
+ * Cached writer for the sysfs and procfs nodes changed on Android screen sleep
+ * and wake. Each node is opened once and written with a single pwrite.
+ */
+#define  SYSFS_VALSZ    16          /* longest value written            */
+
+typedef struct {
+   char           *path;            /* node path                        */
+   int            fd;               /* cached descriptor, -1 if closed  */
+   H_UINT         absent;           /* open failed, not retried         */
+   H_UINT         fails;            /* failed writes                    */
+   char           last[SYSFS_VALSZ];/* last value written               */
+} H_SYSNODE;
+
+typedef struct {
+   H_SYSNODE      *node;            /* nodes seen                       */
+   H_UINT         n;                /* nodes in use                     */
+   H_UINT         max;              /* nodes allocated                  */
+   H_UINT         opens;            /* open() calls                     */
+   H_UINT         writes;           /* pwrite() calls                   */
+   H_UINT         skipped;          /* writes of an unchanged value     */
+   H_UINT         fails;            /* failed writes                    */
+   double         usecs;            /* total write latency              */
+   double         maxUsecs;         /* worst write latency              */
+} H_SYSFS;
+/**
+ * Android screen sleep. While the screen is off the collector is destroyed and
+ * the pool is fed from a reserve of tested output filled before suspending.
+ */
+#define  POWER_RESERVE  16384       /* bytes of output held while asleep */
+#define  POWER_RETRY    64          /* longest wait between restarts, s */
+
+typedef struct {
+   H_UINT         sleeps;           /* collector suspensions            */
+   H_UINT         wakes;            /* collector resumptions            */
+   H_UINT         early;            /* resumed with the screen off      */
+   H_UINT         fails;            /* failed collector restarts        */
+   H_UINT         resuming;         /* restart thread running           */
+   H_UINT         held;             /* reserve bytes filled             */
+   H_UINT         pos;              /* next reserve byte to inject      */
+   double         served;           /* reserve bytes injected           */
+   double         at;               /* time of last screen transition   */
+   double         suspend_ms;       /* last sleep to collector stopped  */
+   double         resume_ms;        /* last wake to collector running   */
+   void           *out;             /* injection buffer while asleep    */
+   H_UINT8        reserve[POWER_RESERVE];
+} H_POWER;
+/**
+ * Scheduling class governor. The collector runs as SCHED_IDLE while the pool is
+ * at the threshold and the reserve is full, and at its normal class once the
+ * pool falls below the low mark.
+ */
+typedef struct {
+   H_UINT         idle;             /* collector is SCHED_IDLE          */
+   H_UINT         switches;         /* class changes                    */
+   H_UINT         fails;            /* class changes refused            */
+   double         since;            /* time of last change, seconds     */
+   double         secs[2];          /* seconds at normal, idle          */
+} H_SCHED;
+/**
+ * Cpu budget. A token bucket of cpu seconds, refilled at the budget rate up to
+ * one window's worth and charged with the cpu time of each fill and of the
+ * daemon itself. It is shared by all collectors, so it lives in an anonymous
+ * shared mapping made before the collectors are forked.
+ */
+#define  BUDGET_WINDOW  10          /* default window, seconds          */
+#define  BUDGET_TICK    0.01        /* daemon cpu sampling, seconds     */
+
+typedef struct {
+   volatile H_UINT lock;            /* held while the bucket changes    */
+   double         rate;             /* cpu seconds allowed per second   */
+   double         cap;              /* bucket size, cpu seconds         */
+   double         tokens;           /* cpu seconds left, < 0 in debt    */
+   double         last;             /* time of last refill, seconds     */
+   double         spent;            /* collector cpu seconds            */
+   double         daemon;           /* daemon cpu seconds outside fills */
+   double         waited;           /* seconds held back by the budget  */
+   H_UINT         fills;            /* fills charged                    */
+   H_UINT         throttles;        /* fills delayed                    */
+} H_BUDGET;
+/**
+ * Pool level history used to forecast demand
+ */
+#define  FORECAST_RING  16          /* level samples kept               */
+#define  FORECAST_LEAD  4           /* wake at 3/4 of the time to drain */
+#define  FORECAST_MAX   3600.0      /* longest forecast used, seconds   */
+
+typedef struct {
+   double         dt[FORECAST_RING];     /* seconds between samples     */
+   double         drain[FORECAST_RING];  /* bits drained in interval    */
+   double         last;             /* time of last sample, seconds     */
+   double         due;              /* forecast wakeup, 0 if none       */
+   int            level;            /* pool level after last sample     */
+   H_UINT         n;                /* samples recorded                 */
+} H_FORECAST;
 
 #endif
@@ -0,0 +1,258 @@
+/**
+ ** Simple entropy harvester based upon the havege RNG
+ **
+ ** Copyright 2009-2014 Gary Wuertz gary@issiweb.com
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * Client side of the shared memory ring published by the haveged EGD service.
+ * See havegering.h for the ring layout and protocol.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "havegering.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+/**
+ * The client instance
+ */
+struct h_ring_client {
+   int         sock;                /* EGD socket, held for the ring lifetime */
+   int         efd;                 /* eventfd to wake the producer           */
+   H_RING      *ring;               /* the mapped ring                        */
+   size_t      size;                /* size of the mapping                    */
+   H_UINT      pos;                 /* next unread byte of cell               */
+   H_UINT      len;                 /* bytes held in cell                     */
+   H_UINT8     *cell;               /* remainder of last claimed cell         */
+};
+/**
+ * Local prototypes
+ */
+static int  ring_claim(H_RING_CLIENT c, H_UINT8 *dst, int block);
+static int  ring_fds(int sock, int *fds);
+/**
+ * Connect to the haveged EGD socket and map its ring
+ */
+H_RING_CLIENT havege_ring_open(  /* RETURN: handle or NULL    */
+   const char *path)             /* IN: EGD socket path       */
+{
+   struct sockaddr_un   sa;
+   struct stat          st;
+   H_RING_CLIENT        c;
+   H_RING               *r;
+   int                  fds[2] = {-1, -1};
+   int                  sock;
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(sa.sun_path)) {
+      errno = ENAMETOOLONG;
+      return NULL;
+      }
+   strcpy(sa.sun_path, path);
+   if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return NULL;
+   if (connect(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0 || ring_fds(sock, fds) < 0
+         || fstat(fds[0], &st) < 0) {
+      if (fds[0] >= 0) {
+         close(fds[0]);
+         close(fds[1]);
+         }
+      close(sock);
+      return NULL;
+      }
+   r = (H_RING *) mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0);
+   close(fds[0]);
+   if (r == MAP_FAILED || r->magic != HRING_MAGIC || r->version != HRING_VERSION
+         || NULL == (c = calloc(1, sizeof(struct h_ring_client)))
+         || NULL == (c->cell = malloc(r->cellSz))) {
+      if (r != MAP_FAILED)
+         munmap(r, st.st_size);
+      close(fds[1]);
+      close(sock);
+      errno = EPROTO;
+      return NULL;
+      }
+   c->sock = sock;
+   c->efd  = fds[1];
+   c->ring = r;
+   c->size = st.st_size;
+   return c;
+}
+/**
+ * Read from the ring. Whole cells are copied straight to the caller, the rest of
+ * a partly used cell is kept for the next read.
+ */
+int havege_ring_read(      /* RETURN: bytes read or -1   */
+   H_RING_CLIENT c,        /* IN: client handle          */
+   void *buf,              /* OUT: destination           */
+   size_t n,               /* IN: bytes wanted           */
+   int block)              /* IN: wait for n bytes       */
+{
+   H_UINT8  *dst = (H_UINT8 *) buf;
+   size_t   k, done = 0;
+
+   if (NULL == c) {
+      errno = EINVAL;
+      return -1;
+      }
+   while(done < n) {
+      if (c->pos < c->len) {
+         k = c->len - c->pos;
+         if (k > n - done)
+            k = n - done;
+         memcpy(dst + done, c->cell + c->pos, k);
+         c->pos += k;
+         done += k;
+         }
+      else if (n - done >= c->ring->cellSz) {
+         if (0 == ring_claim(c, dst + done, block))
+            break;
+         done += c->ring->cellSz;
+         }
+      else {
+         if (0 == ring_claim(c, c->cell, block))
+            break;
+         c->pos = 0;
+         c->len = c->ring->cellSz;
+         }
+      }
+   return (int)done;
+}
+/**
+ * Release the client
+ */
+void havege_ring_close(    /* RETURN: nothing            */
+   H_RING_CLIENT c)        /* IN: client handle          */
+{
+   if (NULL != c) {
+      munmap((void *)c->ring, c->size);
+      close(c->efd);
+      close(c->sock);
+      free(c->cell);
+      free(c);
+      }
+}
+/**
+ * Claim the cell at head and copy it out. The cell is handed back to the producer
+ * by advancing its sequence a lap, and the producer is woken if it is waiting.
+ */
+static int ring_claim(     /* RETURN: 1 if claimed, 0 if empty */
+   H_RING_CLIENT c,        /* IN: client handle                */
+   H_UINT8 *dst,           /* OUT: cell destination            */
+   int block)              /* IN: wait for data                */
+{
+   H_RING   *r = c->ring;
+   H_UINT   mask = r->nCells - 1, pos, pub;
+   uint64_t one = 1;
+   ssize_t  w;
+   int      d;
+
+   for(;;) {
+      pub = r->published;
+      pos = r->head;
+      d = (int)(r->seq[pos & mask] - (pos + 1));
+      if (d == 0) {
+         if (__sync_bool_compare_and_swap(&r->head, pos, pos + 1)) {
+            __sync_synchronize();
+            memcpy(dst, HRING_DATA(r, pos), r->cellSz);
+            __sync_synchronize();
+            r->seq[pos & mask] = pos + r->nCells;
+            __sync_synchronize();   /* pairs with the producer arming wake */
+            if (0 != r->wake) {
+               w = write(c->efd, &one, sizeof(one));
+               (void)w;             /* a full counter is still a wakeup */
+               }
+            return 1;
+            }
+         }
+      else if (d < 0) {
+         if (0 == block)
+            return 0;
+         __sync_fetch_and_add(&r->waiters, 1);
+         syscall(SYS_futex, &r->published, FUTEX_WAIT, pub, NULL, NULL, 0);
+         __sync_fetch_and_sub(&r->waiters, 1);
+         }
+      }
+}
+/**
+ * Request the ring from the EGD service. The reply is a status byte with the
+ * memfd and producer eventfd attached.
+ */
+static int ring_fds(       /* RETURN: 0 on success       */
+   int sock,               /* IN: EGD socket             */
+   int *fds)               /* OUT: memfd, eventfd        */
+{
+   struct msghdr  msg;
+   struct iovec   iov;
+   struct cmsghdr *cm;
+   union {
+      struct cmsghdr cm;
+      char           space[CMSG_SPACE(2 * sizeof(int))];
+   } ctl;
+   H_UINT8        cmd = HRING_CMD, status = 1;
+
+   if (write(sock, &cmd, 1) != 1)
+      return -1;
+   memset(&msg, 0, sizeof(msg));
+   iov.iov_base       = &status;
+   iov.iov_len        = 1;
+   msg.msg_iov        = &iov;
+   msg.msg_iovlen     = 1;
+   msg.msg_control    = ctl.space;
+   msg.msg_controllen = sizeof(ctl.space);
+   if (recvmsg(sock, &msg, 0) != 1)
+      return -1;
+   if (status != 0) {
+      errno = status == HRING_REFUSED? EACCES : ENODEV;
+      return -1;
+      }
+   cm = CMSG_FIRSTHDR(&msg);
+   if (NULL == cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS
+         || cm->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+      return -1;
+   memcpy(fds, CMSG_DATA(cm), 2 * sizeof(int));
+   return 0;
+}
+#else
+/**
+ * The ring needs memfd, futex and descriptor passing
+ */
+H_RING_CLIENT havege_ring_open(const char *path)
+{
+   (void)path;
+   errno = ENOSYS;
+   return NULL;
+}
+int havege_ring_read(H_RING_CLIENT c, void *buf, size_t n, int block)
+{
+   (void)c; (void)buf; (void)n; (void)block;
+   errno = ENOSYS;
+   return -1;
+}
+void havege_ring_close(H_RING_CLIENT c)
+{
+   (void)c;
+}
+#endif
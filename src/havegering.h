@@ -0,0 +1,101 @@
+/**
+ ** Simple entropy harvester based upon the havege RNG
+ **
+ ** Copyright 2009-2014 Gary Wuertz gary@issiweb.com
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HAVEGERING_H
+#define HAVEGERING_H
+
+#include <stddef.h>
+#include "havege.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Shared memory ring published by the haveged EGD service. The ring is a memfd
+ * passed to clients over the EGD socket, holding nCells cells of cellSz bytes
+ * of tested output. There is a single producer (haveged) and any number of
+ * consumers. Each cell carries a sequence number:
+ *
+ *    seq == pos + 1         cell at ring position pos is published
+ *    seq == pos + nCells    cell is consumed, free for the next lap
+ *
+ * A consumer claims a cell by advancing head with compare and swap, so every
+ * byte is delivered to exactly one consumer. Consumers touch no syscall unless
+ * the ring is empty (futex wait on published) or the producer is waiting for
+ * space (eventfd write).
+ *
+ * The ring is mapped read-write by every consumer and a claimed cell keeps its
+ * data until the next lap, so the exactly once delivery holds only between
+ * consumers that cooperate: any consumer can read the cells others claim and
+ * rewrite cells or cursors. All consumers of a ring share one trust domain, and
+ * the daemon passes the ring only to peers running as root or as its own user
+ * or group. Other clients get HRING_REFUSED and should use the EGD reads.
+ */
+#define  HRING_MAGIC       0x48524e47        /* "HRNG"                       */
+#define  HRING_VERSION     1
+#define  HRING_CELL        4096              /* default bytes per cell       */
+#define  HRING_CMD         0x11              /* EGD command to map the ring  */
+#define  HRING_NORING      1                 /* status: no ring offered      */
+#define  HRING_REFUSED     2                 /* status: peer not trusted     */
+
+typedef struct {
+   H_UINT            magic;                  /* HRING_MAGIC                  */
+   H_UINT            version;                /* HRING_VERSION                */
+   H_UINT            nCells;                 /* cells in ring, power of 2    */
+   H_UINT            cellSz;                 /* bytes per cell               */
+   H_UINT            offset;                 /* offset of first cell         */
+   volatile H_UINT   wake;                   /* producer waits for space     */
+   volatile H_UINT   waiters;                /* consumers waiting for data   */
+   volatile H_UINT   published;              /* futex word, cells published  */
+   H_UINT            pad0[8];                /* keep cursors on own lines    */
+   volatile H_UINT   head;                   /* next cell to consume         */
+   H_UINT            pad1[15];
+   volatile H_UINT   tail;                   /* next cell to publish         */
+   H_UINT            pad2[15];
+   volatile H_UINT   seq[1];                 /* cell sequence numbers        */
+} H_RING;
+/**
+ * Bytes needed for a ring of n cells of sz bytes
+ */
+#define  HRING_OFFSET(n)   ((sizeof(H_RING) + ((n)-1)*sizeof(H_UINT) + 63) & ~63)
+#define  HRING_SIZE(n,sz)  (HRING_OFFSET(n) + (size_t)(n)*(sz))
+#define  HRING_DATA(r,i)   ((H_UINT8 *)(r) + (r)->offset + (size_t)((i) & ((r)->nCells-1))*(r)->cellSz)
+/**
+ * Client handle, opaque to callers
+ */
+typedef struct h_ring_client *H_RING_CLIENT;
+/**
+ * Connect to the haveged EGD socket at path and map its ring. Returns NULL on
+ * failure with errno set, EACCES if the daemon does not trust the caller.
+ */
+H_RING_CLIENT havege_ring_open(const char *path);
+/**
+ * Read n bytes. If block is zero, return what is available without waiting,
+ * otherwise wait until n bytes have been read. Returns bytes read or -1.
+ */
+int havege_ring_read(H_RING_CLIENT c, void *buf, size_t n, int block);
+/**
+ * Unmap the ring and release the handle
+ */
+void havege_ring_close(H_RING_CLIENT c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
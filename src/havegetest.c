@@ -32,6 +32,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include "havegetest.h"
+#if defined(RAW_IN_ENABLE)
+#include <time.h>
+#endif
+#if NUMBER_CORES>1
+#include <pthread.h>
+#endif
 
 #ifdef ONLINE_TESTS_ENABLE
 /**
@@ -50,6 +56,34 @@ typedef struct {
    procA         pa;
    procB         pb;
 } testsMemory;
+#if NUMBER_CORES>1
+/**
+ * When both tot procedures are configured, multi-core builds run procedure A on a
+ * worker thread while procedure B runs in the collector. Both read the same startup
+ * stream: the collector queues a copy of each fill for the worker, which tests it
+ * against a shadow collector and context so the two procedures never share state.
+ */
+typedef struct totFill {
+   struct totFill  *next;        /* next queued fill           */
+   H_UINT          data[1];      /* copy of collection buffer  */
+} totFill;
+
+typedef struct {
+   pthread_t       thread;       /* procedure A worker         */
+   pthread_mutex_t lock;         /* protects fields below      */
+   pthread_cond_t  ready;        /* fill queued or stop        */
+   pthread_cond_t  idle;         /* worker done or starved     */
+   totFill         *head;        /* queued fills               */
+   totFill         *tail;        /* last queued fill           */
+   H_UINT          sz;           /* fill size in H_UINT        */
+   H_UINT          aDone;        /* procedure A complete       */
+   H_UINT          bDone;        /* procedure B complete       */
+   H_UINT          starved;      /* worker waiting for input   */
+   H_UINT          stop;         /* worker must exit           */
+   onlineTests     olt;          /* worker test context        */
+   H_COLLECT       *shadow;      /* worker collector header    */
+} totConcurrent;
+#endif
 /**
  * The tests and supporting methods
  */
@@ -58,18 +92,36 @@ static H_UINT aisProcedureA(H_COLLECT *h_ctxt, procShared *tps,
 static H_UINT aisProcedureB(H_COLLECT *h_ctxt, procShared *tps,
                   procB *context, H_UINT *buffer, H_UINT sz, H_UINT offs, H_UINT prod);
 static H_UINT aisSeq(procB *p, H_UINT offs, H_UINT id);
+static H_UINT aisSeqBulk(procB *p, H_UINT offs, H_UINT tid, H_UINT n);
 static H_UINT aisTest(H_COLLECT * h_ctxt, H_UINT prod, H_UINT *buffer, H_UINT sz);
 static H_UINT copyBits(procA *p, H_UINT ct,H_UINT sz);
 static H_UINT fips140(procShared *tps, procA *p, H_UINT offs, H_UINT id);
+static void   fips140Setup(fipsByte *t, H_UINT b);
 static H_UINT test0(procA *p, H_UINT offs, H_UINT id);
+#ifdef TEST0_QSORT
 static int    test0cmp(const void *aa, const void *bb);
+#endif
 static H_UINT test5(procA *p, H_UINT offs, H_UINT id);
-static H_UINT test5XOR(H_UINT8 *src, H_UINT shift);
+static H_UINT test5XOR(uint64_t *src, H_UINT first, H_UINT shift);
 static H_UINT test6a(procB *p, H_UINT offs, H_UINT id);
 static H_UINT test8(procShared *tps, procB *p, H_UINT offs, H_UINT id);
+static H_UINT test8Bytes(procShared *tps, procB *p, H_UINT8 *src, H_UINT align, H_UINT n,
+                  H_UINT *pk, double *pTG);
+#if defined(RAW_IN_ENABLE)
+static double testsClock(void);
+#endif
 static int    testsDiscard(H_COLLECT *rdr);
+static H_UINT testsHealth(procShared *tps, onlineTests *context, H_UINT8 *src, H_UINT n);
+static H_UINT testsHealthSetup(void);
 static void   testsMute(H_COLLECT * h_ctxt, H_UINT action, H_UINT prod, H_UINT state, H_UINT ct);
+static int    testsRelease(H_COLLECT *rdr);
 static int    testsRun(H_COLLECT *rdr, H_UINT prod);
+static H_UINT testsSkip(procShared *tps, onlineTests *context);
+#if NUMBER_CORES>1
+static int    testsTot(H_COLLECT *h_ctxt, procShared *tps, onlineTests *context);
+static void   testsTotEnd(H_COLLECT *h_ctxt, onlineTests *context);
+static void   *testsTotA(void *arg);
+#endif
 
 /**
  * The following suite of macros encapsulate the major bit operations of the test suite.
@@ -86,6 +138,45 @@ static int    testsRun(H_COLLECT *rdr, H_UINT prod);
 #define  BITSTREAM_OPEN(a,b)  H_UINT8 *bitstream_src=(H_UINT8 *)(a);\
                               H_UINT   bitstream_in=0x80>>((b)%8);\
                               bitstream_src+=(b)/8
+/**
+ * Bulk operations work 8 bytes at a time. Bits are numbered MSB first, so words
+ * are loaded and stored in big endian order. memcpy() keeps the accesses safe on
+ * hosts that fault on unaligned loads.
+ */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+#define  LOAD_BE64(w,s)       {memcpy(&w, s, 8);w = __builtin_bswap64(w);}
+#define  STORE_BE64(d,w)      {uint64_t t = __builtin_bswap64(w);memcpy(d, &t, 8);}
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+#define  LOAD_BE64(w,s)       memcpy(&w, s, 8)
+#define  STORE_BE64(d,w)      memcpy(d, &w, 8)
+#else
+#define  LOAD_BE64(w,s)       {H_UINT k;for(w=k=0;k<8;k++) w = (w<<8) | (s)[k];}
+#define  STORE_BE64(d,w)      {H_UINT k;for(k=0;k<8;k++) (d)[k] = (H_UINT8)((w)>>(56-8*k));}
+#endif
+/**
+ * Test timing for diagnostic builds. Per thread CPU time is used when available so
+ * that collection time is not charged to the tests.
+ */
+#if defined(RAW_IN_ENABLE)
+#define  TIMER_START(t)       t = testsClock()
+#define  TIMER_STOP(t,n)      tps->cpuTime[prod? 1 : 0][n] += testsClock() - t
+#else
+#define  TIMER_START(t)
+#define  TIMER_STOP(t,n)
+#endif
+/**
+ * Accumulate the number of bits set in a 64 bit word. Use the hardware instruction
+ * when the compiler has been told it exists, otherwise fall back to a sideways add.
+ */
+#if defined(__GNUC__) && defined(__POPCNT__)
+#define  POPCOUNT64(c,w)      c += __builtin_popcountll(w)
+#else
+#define  POPCOUNT64(c,w)      {uint64_t in = w;\
+                              in -= (in >> 1) & 0x5555555555555555ULL;\
+                              in = (in & 0x3333333333333333ULL) + ((in >> 2) & 0x3333333333333333ULL);\
+                              c += (H_UINT)((((in + (in >> 4)) & 0x0f0f0f0f0f0f0f0fULL) * 0x0101010101010101ULL) >> 56);\
+                              }
+#endif
 /**
  * Setup shared resources for online tests by sorting the test options into "tot"
  * and production groupings and allocating any resources used by the tests.
@@ -101,6 +192,7 @@ int   havege_test(         /* RETURN: nz on failure   */
    tps->discard   = testsDiscard;
    if (0==tps->report)
       tps->report = testsMute;
+   tps->release   = testsRelease;
    tps->run       = testsRun;
    tps->options   = params->options;
 
@@ -113,6 +205,12 @@ int   havege_test(         /* RETURN: nz on failure   */
          tps->fips_low[i]  = low[i];
          tps->fips_high[i] = high[i];
          }
+      for (i=0;i<256;i++)
+         fips140Setup(&tps->fips_bytes[i], i);
+      }
+   if (0!=(tps->testsUsed & H_RUN)) {
+      tps->rctCutoff = 1 + (HEALTH_ALPHA + HEALTH_H - 1) / HEALTH_H;
+      tps->aptCutoff = testsHealthSetup();
       }
    if (0!=(tps->testsUsed & B_RUN)) {
       tps->G = (double *) malloc((Q+K+1)*sizeof(double));
@@ -126,11 +224,29 @@ int   havege_test(         /* RETURN: nz on failure   */
       }
    return 0;
 }
+#if defined(RAW_IN_ENABLE)
+/**
+ * CPU seconds used by the caller
+ */
+static double testsClock(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+   struct timespec ts;
+
+   if (0==clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+      return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+   return (double)clock() / CLOCKS_PER_SEC;
+}
+#endif
 /**
  * Check if the current buffer should be released if continuous testing is
  * being performed. The buffer must be discarded if it contains an
  * uncompleted retry or an uncompleted procedure with a failed test
- * or a failed procedure.
+ * or a failed procedure. Fills skipped by sampling are copied to the hold
+ * and discarded here, testsRelease() serves them once the next tested
+ * window passes. A failed or retried window drops the hold. Tested fills
+ * update the averages used by testsSkip().
  */
 static int testsDiscard(   /* RETURN: non-zero to discard   */
    H_COLLECT * h_ctxt)     /* IN-OUT: collector context     */
@@ -142,26 +258,161 @@ static int testsDiscard(   /* RETURN: non-zero to discard   */
 
    if (0==tps->testsUsed)
       return 0;
-   if (context->result!=0)
+   if (context->result!=0) {
+      context->held = context->freed = 0;
       return -1;
+      }
+   if (0!=context->skipped) {
+      tps->coverage[1] += 1;
+      memcpy(context->hold + context->held * h_ctxt->havege_szFill,
+         (H_UINT *)h_ctxt->havege_bigarray, h_ctxt->havege_szFill * sizeof(H_UINT));
+      context->held += 1;
+      return 1;
+      }
+   tps->coverage[0] += 1;
+   if (0!=tps->budget) {
+      if (0==context->tCollect) {
+         context->tCollect = h_ctxt->havege_tCollect;
+         context->tTest    = h_ctxt->havege_tTest;
+         }
+      else {
+         context->tCollect += (h_ctxt->havege_tCollect>>3) - (context->tCollect>>3);
+         context->tTest    += (h_ctxt->havege_tTest>>3) - (context->tTest>>3);
+         }
+      if (0!=context->skip)                        /* fill ends a passed window     */
+         return 0;
+      }
    p = tps->runTests + context->runIdx;
    switch(p->action) {
       case A_RUN:
          if (0 != context->pA->procRetry)
-            return 1;
+            break;
          for (i = 0;i<context->pA->testRun;i++)
             if (0 !=(context->pA->results[i].testResult & 1))
-               return 1;
-         break;
+               break;
+         if (i<context->pA->testRun)
+            break;
+         return 0;
       case B_RUN:
          if (0 != context->pB->procRetry)
-            return 1;
+            break;
          for (i=0;i<context->pB->testNbr;i++)
             if (0!=(context->pB->results[i].testResult & 0xff))
-               return 1;
-         break;
+               break;
+         if (i<context->pB->testNbr)
+            break;
+         return 0;
+      default:
+         return 0;
       }
-   return 0;
+   context->held = context->freed = 0;
+   return 1;
+}
+/**
+ * SP 800-90B repetition count and adaptive proportion tests over the bytes of a
+ * fill. Both tests carry their state across fills, so every byte of continuous
+ * output is covered whether or not the fill is sampled by the procedures. Bytes
+ * are examined 8 at a time: a word without equal neighbours resets the repetition
+ * count, and adaptive proportion matches are counted as zero bytes of the word
+ * xored with the replicated sample. Returns a bit map of the failed tests: 1 for
+ * repetition count, 2 for adaptive proportion.
+ */
+#define  HEALTH_ONES          0x0101010101010101ULL
+#define  HEALTH_LOWS          0x7f7f7f7f7f7f7f7fULL
+#define  HEALTH_HIGHS         0x8080808080808080ULL
+#define  HEALTH_RCT(c)        if ((c)==last) {\
+                                 if (++run >= tps->rctCutoff) {\
+                                    r |= 1;\
+                                    run = 1;\
+                                    }\
+                                 }\
+                              else {\
+                                 last = (c);\
+                                 run  = 1;\
+                                 }
+#define  HEALTH_APT(c)        if (0==ai)\
+                                 a = (c), ac = 0;\
+                              ac += ((c)==a);\
+                              if (++ai == HEALTH_APT_W) {\
+                                 if (ac >= tps->aptCutoff)\
+                                    r |= 2;\
+                                 ai = 0;\
+                                 }
+static H_UINT testsHealth(    /* RETURN: nz on failure         */
+   procShared *tps,           /* IN: shared data               */
+   onlineTests *context,      /* IN-OUT: test context          */
+   H_UINT8 *src,              /* IN: fill data                 */
+   H_UINT n)                  /* IN: bytes in fill             */
+{
+   H_UINT   last = context->rctLast, run = context->rctRun;
+   H_UINT   a = context->aptSample, ac = context->aptCount, ai = context->aptIdx;
+   H_UINT   c, i, k, r = 0;
+   uint64_t x, d;
+
+   for (i=0;i<n && 0!=(ai & 7);i++) {
+      c = src[i];
+      HEALTH_RCT(c);
+      HEALTH_APT(c);
+      }
+   for (;(i+8)<=n;i+=8) {
+      LOAD_BE64(x, src+i);
+      d = x ^ ((x >> 8) | ((uint64_t)last << 56));
+      if (0!=((d - HEALTH_ONES) & ~d & HEALTH_HIGHS))
+         for (k=0;k<8;k++) {
+            c = (H_UINT)(x >> (56 - 8*k)) & 0xff;
+            HEALTH_RCT(c);
+            }
+      else {
+         last = (H_UINT)x & 0xff;
+         run  = 1;
+         }
+      if (0==ai) {
+         a  = (H_UINT)(x >> 56);
+         ac = 0;
+         }
+      d  = x ^ (a * HEALTH_ONES);
+      d  = ~(((d & HEALTH_LOWS) + HEALTH_LOWS) | d) & HEALTH_HIGHS;
+      if (0!=d)
+         POPCOUNT64(ac, d);
+      if ((ai += 8) == HEALTH_APT_W) {
+         if (ac >= tps->aptCutoff)
+            r |= 2;
+         ai = 0;
+         }
+      }
+   for (;i<n;i++) {
+      c = src[i];
+      HEALTH_RCT(c);
+      HEALTH_APT(c);
+      }
+   context->rctLast   = last;
+   context->rctRun    = run;
+   context->aptSample = a;
+   context->aptCount  = ac;
+   context->aptIdx    = ai;
+   return r;
+}
+/**
+ * The adaptive proportion cutoff of SP 800-90B 4.4.2, C = 1 + CRITBINOM(W, 2^-H,
+ * 1 - alpha): 1 + the smallest count c with P(X > c) at most 2^-HEALTH_ALPHA for
+ * X ~ Binomial(HEALTH_APT_W, 2^-HEALTH_H). The loop leaves k = c.
+ */
+static H_UINT testsHealthSetup(void)   /* RETURN: cutoff          */
+{
+   double   pmf[HEALTH_APT_W+1];
+   double   p = 1.0 / (1 << HEALTH_H), alpha = 1.0, tail = 0.0;
+   H_UINT   k;
+
+   for (k=0;k<HEALTH_ALPHA;k++)
+      alpha /= 2.0;
+   for (pmf[0]=1.0,k=0;k<HEALTH_APT_W;k++)
+      pmf[0] *= 1.0 - p;
+   for (k=0;k<HEALTH_APT_W;k++)
+      pmf[k+1] = pmf[k] * (HEALTH_APT_W - k) / (k + 1) * p / (1.0 - p);
+   for (k=HEALTH_APT_W;k>0;k--)
+      if ((tail += pmf[k]) > alpha)
+         break;
+   return k + 1;
 }
 /**
  * Place holder for when report is not configured
@@ -217,11 +468,232 @@ static int testsRun(       /* RETURN: nz if input needed    */
          context->pB->procState = TEST_INIT;
          }
       h_ctxt->havege_tests = context;
-      if (0 != (h_ctxt->havege_raw & H_DEBUG_TEST_IN))
+      if (0==prod && 0 != (h_ctxt->havege_raw & H_DEBUG_TEST_IN))
+         return 1;                                 /* no warm up, inject tot input  */
+      }
+   if (0!=prod) {
+      context = TESTS_CONTEXT(h_ctxt);
+      if (0!=tps->health) {
+         H_UINT r = testsHealth(tps, context, (H_UINT8 *)h_ctxt->havege_bigarray,
+            h_ctxt->havege_szFill * sizeof(H_UINT));
+
+         if (0!=r) {                               /* advisory only if warn         */
+            tps->meters[H_OLT_PROD_H_F] += 1;
+            if (0==(tps->health & H_WARN)) {
+               context->result = H_RUN;
+               h_ctxt->havege_err = H_NOTESTRUN;
+               tps->report(h_ctxt, H_RUN, prod, TEST_FAIL, r);
+               return 0;
+               }
+            tps->report(h_ctxt, H_RUN, prod, TEST_IGNORE, r);
+            }
+         else tps->meters[H_OLT_PROD_H_P] += 1;
+         }
+      context->skipped = 0;
+      if (context->skip>0 && 0==context->hold)     /* hold for the skipped fills    */
+         context->hold = (H_UINT *) malloc(S_SKIP_MAX * h_ctxt->havege_szFill * sizeof(H_UINT));
+      if (context->skip>0 && 0!=context->hold) {   /* sampling, hold untested       */
+         context->skip -= 1;
+         context->skipped = 1;
          return 0;
+         }
+      context->skip = 0;
+      context->wFills += 1;
       }
+#if NUMBER_CORES>1
+   else if (0!=(tps->testsUsed & A_RUN) && A_RUN==tps->totTests[1].action)
+      return testsTot(h_ctxt, tps, TESTS_CONTEXT(h_ctxt));
+#endif
    return aisTest(h_ctxt, prod, (H_UINT *)h_ctxt->havege_bigarray, h_ctxt->havege_szFill);
 }
+/**
+ * Serve a skipped fill from the hold once the window after it has passed. The
+ * fill was gathered and estimated before it was held, so it is copied back as
+ * it stands.
+ */
+static int testsRelease(   /* RETURN: nz if a fill was served */
+   H_COLLECT * h_ctxt)     /* IN-OUT: collector context     */
+{
+   onlineTests *context = (onlineTests *) h_ctxt->havege_tests;
+
+   if (0==context || 0==context->freed || 0==context->held)
+      return 0;
+   context->held -= 1;
+   memcpy((H_UINT *)h_ctxt->havege_bigarray, context->hold + context->held * h_ctxt->havege_szFill,
+      h_ctxt->havege_szFill * sizeof(H_UINT));
+   if (0==context->held)
+      context->freed = 0;
+   return 1;
+}
+/**
+ * Continuous test sampling. Called when a continuous procedure passes cleanly,
+ * returns the number of fills to release untested so that the test ticks of the
+ * window just completed stay within the budget share of the collection ticks of
+ * the window and the gap that follows it. Running averages are kept by
+ * testsDiscard(), no skip is taken until the first estimates are available.
+ */
+static H_UINT testsSkip(   /* RETURN: fills to skip         */
+   procShared *tps,        /* IN: shared data               */
+   onlineTests *context)   /* IN-OUT: test context          */
+{
+   double n = context->wFills;
+   double c = (double)context->tCollect * tps->budget / 100.0;
+   double s;
+
+   context->wFills = 0;
+   if (c <= 0.0)
+      return 0;
+   s = n * context->tTest / c - n;
+   if (s <= 0.0)
+      return 0;
+   if (s >= S_SKIP_MAX)
+      return S_SKIP_MAX;
+   return (H_UINT)s + ((double)(H_UINT)s < s? 1 : 0);
+}
+#if NUMBER_CORES>1
+/**
+ * Run the tot procedures concurrently, called once per startup fill. Procedure A is
+ * handed a copy of the fill and procedure B tests it in place. Once B is complete,
+ * more input is requested only if the worker has consumed every queued fill without
+ * finishing. Falls back to serial aisTest() if the worker cannot be started before
+ * procedure B begins.
+ */
+static int testsTot(       /* RETURN: nz if input needed    */
+   H_COLLECT * h_ctxt,     /* IN-OUT: collector context     */
+   procShared *tps,        /* IN: shared data               */
+   onlineTests *context)   /* IN-OUT: test context          */
+{
+   totConcurrent *tc = (totConcurrent *) context->tot;
+   H_UINT        sz = h_ctxt->havege_szFill, more;
+   totFill       *f;
+
+   if (0==tc) {
+      if (0!=context->totIdx || TEST_INIT!=context->pB->procState)
+         return aisTest(h_ctxt, 0, (H_UINT *)h_ctxt->havege_bigarray, sz);
+      tc = (totConcurrent *) calloc(sizeof(totConcurrent), 1);
+      if (0!=tc)
+         tc->shadow = (H_COLLECT *) malloc(sizeof(H_COLLECT));
+      if (0==tc || 0==tc->shadow) {
+         if (0!=tc)
+            free(tc);
+         return aisTest(h_ctxt, 0, (H_UINT *)h_ctxt->havege_bigarray, sz);
+         }
+      memcpy((void *)tc->shadow, (void *)h_ctxt, sizeof(H_COLLECT));
+      tc->shadow->havege_tests = &tc->olt;
+      tc->olt.pA = context->pA;
+      tc->sz = sz;
+      context->pA->options = tps->totTests[1].options;
+      context->pB->options = tps->totTests[0].options;
+      pthread_mutex_init(&tc->lock, NULL);
+      pthread_cond_init(&tc->ready, NULL);
+      pthread_cond_init(&tc->idle, NULL);
+      if (0!=pthread_create(&tc->thread, NULL, testsTotA, tc)) {
+         free((void *)tc->shadow);
+         free(tc);
+         return aisTest(h_ctxt, 0, (H_UINT *)h_ctxt->havege_bigarray, sz);
+         }
+      context->tot = tc;
+      context->totIdx = 1;
+      }
+   if (0==tc->aDone && 0!=(f = (totFill *) malloc(sizeof(totFill) + sz * sizeof(H_UINT)))) {
+      memcpy(f->data, (void *)h_ctxt->havege_bigarray, sz * sizeof(H_UINT));
+      f->next = 0;
+      pthread_mutex_lock(&tc->lock);
+      if (0==tc->tail)
+         tc->head = f;
+      else tc->tail->next = f;
+      tc->tail = f;
+      tc->starved = 0;
+      pthread_cond_signal(&tc->ready);
+      pthread_mutex_unlock(&tc->lock);
+      }
+   else if (0==tc->aDone) {
+      h_ctxt->havege_err = H_NOTESTMEM;
+      context->result = A_RUN;
+      }
+   if (0==tc->bDone && 0==context->result) {
+      context->szTotal += aisProcedureB(h_ctxt, tps, context->pB,
+         (H_UINT *)h_ctxt->havege_bigarray, sz, 0, 0);
+      tc->bDone = context->pB->procState != TEST_INPUT;
+      }
+   pthread_mutex_lock(&tc->lock);
+   if (0!=context->result)
+      tc->stop = 1;
+   else if (0!=tc->bDone)
+      while(0==tc->aDone && (0!=tc->head || 0==tc->starved))
+         pthread_cond_wait(&tc->idle, &tc->lock);
+   more = 0==tc->stop && (0==tc->aDone || 0==tc->bDone);
+   pthread_cond_signal(&tc->ready);
+   pthread_mutex_unlock(&tc->lock);
+   if (0!=more)
+      return 1;
+   testsTotEnd(h_ctxt, context);
+   return 0;
+}
+/**
+ * Collect the tot worker and merge its results into the collector context
+ */
+static void testsTotEnd(
+   H_COLLECT * h_ctxt,     /* IN-OUT: collector context     */
+   onlineTests *context)   /* IN-OUT: test context          */
+{
+   totConcurrent *tc = (totConcurrent *) context->tot;
+   totFill       *f;
+
+   pthread_join(tc->thread, NULL);
+   context->szTotal += tc->olt.szTotal;
+   if (0==context->result && 0!=tc->olt.result) {
+      context->result = tc->olt.result;
+      h_ctxt->havege_err = tc->shadow->havege_err;
+      }
+   while(0!=(f = tc->head)) {
+      tc->head = f->next;
+      free(f);
+      }
+   pthread_cond_destroy(&tc->idle);
+   pthread_cond_destroy(&tc->ready);
+   pthread_mutex_destroy(&tc->lock);
+   free((void *)tc->shadow);
+   free(tc);
+   context->tot = 0;
+}
+/**
+ * The tot procedure A worker. Queued fills are tested in order until the procedure
+ * leaves the input state or the collector asks the worker to stop.
+ */
+static void *testsTotA(    /* RETURN: NULL                  */
+   void *arg)              /* IN-OUT: concurrent tot state  */
+{
+   totConcurrent *tc = (totConcurrent *) arg;
+   H_COLLECT     *h_ctxt = tc->shadow;
+   procShared    *tps = TESTS_SHARED(h_ctxt);
+   totFill       *f;
+   H_UINT        tot;
+
+   pthread_mutex_lock(&tc->lock);
+   while(0==tc->aDone && 0==tc->stop) {
+      if (0==(f = tc->head)) {
+         tc->starved = 1;
+         pthread_cond_signal(&tc->idle);
+         pthread_cond_wait(&tc->ready, &tc->lock);
+         continue;
+         }
+      if (0==(tc->head = f->next))
+         tc->tail = 0;
+      pthread_mutex_unlock(&tc->lock);
+      tot = aisProcedureA(h_ctxt, tps, tc->olt.pA, f->data, tc->sz, 0, 0);
+      free(f);
+      pthread_mutex_lock(&tc->lock);
+      if (tc->olt.pA->procState != TEST_INPUT) {
+         tc->olt.szTotal += tot;
+         tc->aDone = 1;
+         }
+      }
+   pthread_cond_signal(&tc->idle);
+   pthread_mutex_unlock(&tc->lock);
+   return NULL;
+}
+#endif
 /**
  * AIS-31 test procedure A. The test is initiated by setting procState to TEST_INIT and
  * the test is performed by calling the procedure adding input until completion is indicated
@@ -245,6 +717,9 @@ static H_UINT aisProcedureA(  /* RETURN: bits used             */
 {
    onlineTests *context = TESTS_CONTEXT(h_ctxt);
    H_UINT i, r;
+#if defined(RAW_IN_ENABLE)
+   double t;
+#endif
 
    switch(p->procState) {
       case TEST_INIT:
@@ -259,15 +734,19 @@ static H_UINT aisProcedureA(  /* RETURN: bits used             */
          p->range = sz * sizeof(H_UINT) <<3;
          while(p->testRun < tps->procReps) {
             p->testId  = p->testRun<6? p->testRun : (1+(p->testRun-6) % 5);
+            TIMER_START(t);
             switch(p->testId) {
                case 0:
                   ct = test0(p, ct, p->testRun);
+                  TIMER_STOP(t, TIME_TEST0);
                   break;
                case 1:  case 2:  case 3: case 4:
                   ct = fips140(tps, p, ct, p->testRun);
+                  TIMER_STOP(t, TIME_FIPS);
                   break;
                case 5:
                   ct = test5(p, ct, p->testRun);
+                  TIMER_STOP(t, TIME_TEST5);
                   break;
                }
             context->szCarry = ct;
@@ -324,6 +803,9 @@ static H_UINT aisProcedureB(  /* RETURN: bits used             */
 {
    onlineTests *context = TESTS_CONTEXT(h_ctxt);
    H_UINT i, r;
+#if defined(RAW_IN_ENABLE)
+   double t;
+#endif
    
    switch(p->procState) {
       case TEST_INIT:
@@ -339,10 +821,11 @@ static H_UINT aisProcedureB(  /* RETURN: bits used             */
          i = p->testId;
          while(p->testState != TEST_DONE && i < 5) {
             p->seq   = 1<<i;
+            TIMER_START(t);
             switch(i) {
-               case 0:  ct = test6a(p, ct, i);     break;
-               case 4:  ct = test8(tps,p,ct,i);    break;
-               default: ct = aisSeq(p,ct,i);       break;
+               case 0:  ct = test6a(p, ct, i);     TIMER_STOP(t, TIME_TEST6A);   break;
+               case 4:  ct = test8(tps,p,ct,i);    TIMER_STOP(t, TIME_TEST8);    break;
+               default: ct = aisSeq(p,ct,i);       TIMER_STOP(t, TIME_SEQ);      break;
                }
             if (p->testState == TEST_INPUT)
                break;
@@ -398,7 +881,7 @@ static H_UINT aisSeq(      /* RETURN: last bit index  */
 {
    static const H_UINT seq_dead[5]  = {0, 50, 120, 258, 0};     /* dead man limit */
    static const H_UINT seq_mask[5]  = {0, 3, 15, 255, 0};       /* full mask      */
-   H_UINT   i=0, c, deadman, r, s, j, hilf;
+   H_UINT   i=0, c, deadman, r, s, j, hilf, bulk=1;
    
    switch(p->testState) {
       case TEST_INIT:
@@ -416,6 +899,16 @@ static H_UINT aisSeq(      /* RETURN: last bit index  */
          {
             BITSTREAM_OPEN(p->noise,offs);
             while(i<r) {
+               if (0==j && 0==p->full && 0!=bulk) {
+                  if (0!=(c = aisSeqBulk(p, offs+i, tid, (r-i)/(tid+1)))) {
+                     i += c;
+                     bitstream_src = (H_UINT8 *)p->noise + ((offs+i)>>3);
+                     bitstream_in  = 0x80>>((offs+i)&7);
+                     deadman = 0;
+                     continue;
+                     }
+                  bulk = 0;
+                  }
                for(;j<tid;i++,j++) {
                   hilf += hilf+(BITSTREAM_BIT());BITSTREAM_NEXT();
                   }
@@ -490,6 +983,52 @@ static H_UINT aisSeq(      /* RETURN: last bit index  */
       }
    return i+offs;
 }
+/**
+ * Bulk tuple counting for aisSeq(). While no bucket is full, every tuple resets the
+ * deadman and no bucket can fill before AIS_LENGTH - 1 - max(counter) more tuples
+ * have been counted. Up to that many tuples are tallied without per tuple checks,
+ * extracted with shifts from 64 bit words that each yield 57 or more bits. Small
+ * batches are left to the bit by bit loop. Returns the number of bits used.
+ */
+static H_UINT aisSeqBulk(  /* RETURN: bits used          */
+   procB *p,               /* IN-OUT: the context        */
+   H_UINT offs,            /* IN: starting bit offset    */
+   H_UINT tid,             /* IN: test id == #bits       */
+   H_UINT n)               /* IN: tuples available       */
+{
+   H_UINT8  *src = (H_UINT8 *)p->noise;
+   H_UINT   end = p->range>>3, w = tid+1, pos = offs;
+   H_UINT   cnt[16], i, k;
+   uint64_t x;
+
+   for (i=k=0;i<p->seq;i++)
+      if (p->counter[i]>k)
+         k = p->counter[i];
+   if ((AIS_LENGTH - 1 - k)<n)
+      n = AIS_LENGTH - 1 - k;
+   if (n < 64)
+      return 0;
+   memset(cnt, 0, sizeof(cnt));
+   for (i=0;i<n && ((pos>>3)+8)<=end;) {
+      LOAD_BE64(x, src + (pos>>3));
+      x <<= pos & 7;
+      k = (64 - 7)/w;
+      if (k > (n-i))
+         k = n - i;
+      i   += k;
+      pos += k * w;
+      while(k-- != 0) {
+         cnt[x>>(64-w)] += 1;
+         x <<= w;
+         }
+      }
+   for (k=0;k<(2U<<tid);k++) {
+      p->counter[k>>1] += cnt[k];
+      if (0!=(k & 1))
+         p->einsen[k>>1] += cnt[k];
+      }
+   return pos - offs;
+}
 /**
  * Run the configured test procedures. This function cycles the procedure calls
  * setup by the configuration using tail recursion to sequence multiple tests.
@@ -541,7 +1080,13 @@ static H_UINT aisTest(     /* RETURN: nz if input needed    */
    else {
       if (0==tps->runTests[0].action)              /* check for no cont tests       */
          return 0;
-      else if (0!=tps->runTests[1].action)         /* check for only 1 cont test    */
+      if (0!=tps->budget && TEST_DONE==state &&
+         0==(p->action==A_RUN? context->pA->procRetry : context->pB->procRetry)) {
+         context->freed = 0!=context->held;        /* the hold has passed           */
+         context->skip = testsSkip(tps, context);  /* clean pass, window may end    */
+         }
+      else context->skip = context->wFills = context->held = context->freed = 0;
+      if (0!=tps->runTests[1].action)              /* check for only 1 cont test    */
          context->runIdx = context->runIdx? 0 : 1;
       p = tps->runTests + context->runIdx;
       }
@@ -553,6 +1098,10 @@ static H_UINT aisTest(     /* RETURN: nz if input needed    */
          context->pB->procState=TEST_INIT;
          break;
       }
+   if (0!=context->skip) {                         /* next window after the skip    */
+      context->szCarry = 0;
+      return 0;
+      }
    offs = context->szCarry/BITS_PER_H_UINT;
    if (offs<sz) {
       context->szCarry -= offs * BITS_PER_H_UINT;
@@ -561,11 +1110,12 @@ static H_UINT aisTest(     /* RETURN: nz if input needed    */
    return 1;
 }
 /**
- * Procedure A input is obtained by copying bits from p->data to p->aux using
- * p->bridge as position. This realigns the input to a byte boundary and
- * resolves segmentation issues. Originally implemented in BITSTREAM macros
- * performance was bad enough to justify serious tuning. Returns the updated
- * bit offset.
+ * Procedure A input is obtained from p->data using p->bridge as position. If the
+ * window starts on a byte boundary and lies entirely within the current input,
+ * the tests read it in place through p->view. Otherwise the bits are copied to
+ * p->aux, which realigns the input to a byte boundary and resolves segmentation
+ * issues. Originally implemented in BITSTREAM macros performance was bad enough
+ * to justify serious tuning. Returns the updated bit offset.
  */
 /**
  * The BITSTREAM macros were totally inadequate for the proecedure A needs. These
@@ -584,8 +1134,14 @@ static H_UINT aisTest(     /* RETURN: nz if input needed    */
                               xfr_bytes = xfr>>3;\
                               xfr_bits = xfr&7;\
                               *dst++ |= c;
+#define COPY_WORD()           {uint64_t w;\
+                              LOAD_BE64(w, src);\
+                              w = (w<<bit_diff_ls) | (src[8]>>bit_diff_rs);\
+                              STORE_BE64(dst, w);\
+                              src += 8;dst += 8;\
+                              }
 /**
- * Each procedure A repetition moves TEST0_USED + 257*FIPS_USED bits
+ * Each procedure A repetition moves at most TEST0_USED + 257*FIPS_USED bits
  * to the auxilary work space - a little more than 1MB
  */
 static H_UINT copyBits(       /* RETURN: updated bit offset    */
@@ -598,6 +1154,13 @@ static H_UINT copyBits(       /* RETURN: updated bit offset    */
    H_UINT xfer, xfr;
    
    offs %= avail;
+   if (0==p->bridge && 0==(offs & 7) && (avail-offs)>=sz) {
+      p->view = p->data + (offs>>3);
+      p->bytesUsed += sz>>3;
+      p->testState = TEST_EVAL;
+      return offs + sz;
+      }
+   p->view = p->aux;
    xfer = (avail-offs)<need? (avail-offs) : need;
    if ((xfr = xfer)!=0) {
       static const H_UINT8 rm[]     = { 0x55, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff };
@@ -639,6 +1202,8 @@ static H_UINT copyBits(       /* RETURN: updated bit offset    */
             c = *src >> bit_diff_rs & rm_xor[dst_bits];
             }
          COPY_FIRST();
+         for (;xfr_bytes >= 8;xfr_bytes -= 8)
+            COPY_WORD();
          while (xfr_bytes-- != 0) {
             COPY_BYTE();
             *dst++ = c;
@@ -663,12 +1228,15 @@ static H_UINT copyBits(       /* RETURN: updated bit offset    */
  * Procedure A tests 1 through 4 correspond to the fips140-1 tests. These tests
  * are conducted on the same input stream, so the calculations can be
  * done in parallel.
+ *
+ * The bit by bit evaluation used a state machine with a few quirks that the
+ * results depend upon: the first run of the window is counted one longer than
+ * the others, and a run is tallied under the value of the bit that ends it.
+ * The table driven version below keeps this. Each byte only touches the run
+ * state at its leading and trailing runs, everything else is accumulated
+ * from a histogram of byte values after the scan.
  */
-#define  FIPS_ADD()  {\
-                     if (runLength < 5)\
-                        runs[runLength + (6*current)]++;\
-                     else runs[5 + (6*current)]++;\
-                     }
+#define  FIPS_ADD(l,b)  runs[((l) < 5? (l) : 5) + (6*(b))]++
 
 static H_UINT fips140(     /* RETURN: updated bit offset */
    procShared  *tps,       /* IN: shared data            */
@@ -676,14 +1244,16 @@ static H_UINT fips140(     /* RETURN: updated bit offset */
    H_UINT offs,            /* IN: starting offset        */
    H_UINT tid)             /* IN: test id                */
 {
+   H_UINT    hist[256];    /* byte value counters        */
    H_UINT    poker[16];    /* counters for poker test    */
    H_UINT    ones;         /* counter for monbit test    */
    H_UINT    runs[12];     /* counters for runs tests    */
    H_UINT    runLength;    /* current run length         */
    H_UINT    maxRun;       /* largest run encountered    */
-   H_UINT    current;      /* current bit                */
-   H_UINT    last;         /* last bit index             */
+   H_UINT    first;        /* first bit of a byte        */
+   H_UINT    last;         /* last bit value             */
    H_UINT    c, i, j, k;
+   fipsByte  *t;
    
    switch(p->testState) {
       case TEST_INIT:
@@ -695,34 +1265,44 @@ static H_UINT fips140(     /* RETURN: updated bit offset */
             break;
       case TEST_EVAL:
          maxRun = ones = runLength = 0;
+         memset(hist, 0, 256*sizeof(H_UINT));
          memset(poker, 0, 16*sizeof(H_UINT));
          memset(runs, 0, 12*sizeof(H_UINT));
-         {
-            BITSTREAM_OPEN(p->aux,0);
-            last = BITSTREAM_BIT();
-            for (c=i=0;i<FIPS_USED;i++) {
-               current = BITSTREAM_BIT();
-               if (current==last) {
-                  if (++runLength>maxRun)
-                     maxRun = runLength;
-                  }
-               else {
-                  FIPS_ADD();
-                  runLength = 0;
-                  last = current;
-                  }
-               c += c + current;
-               ones += current;
-               if (bitstream_in==1) {
-                  poker[c&15] += 1;
-                  c = 0;
-                  }
-               else if (bitstream_in==16)
-                  poker[c] += 1;
-               BITSTREAM_NEXT();
+         last = p->view[0]>>7;
+         for (i=0;i<(FIPS_USED>>3);i++) {
+            c = p->view[i];
+            hist[c] += 1;
+            t = &tps->fips_bytes[c];
+            first = c>>7;
+            if (first==last)
+               runLength += t->lead;
+            else {
+               FIPS_ADD(runLength, first);
+               runLength = t->lead - 1;
                }
-            FIPS_ADD();
-         }
+            if (t->lead != 8) {
+               if (runLength > maxRun)
+                  maxRun = runLength;
+               FIPS_ADD(runLength, first ^ 1);
+               runLength = t->trail - 1;
+               }
+            if (runLength > maxRun)
+               maxRun = runLength;
+            last = c & 1;
+            }
+         FIPS_ADD(runLength, last);
+         for (c=0;c<256;c++) {
+            if (0==(k = hist[c]))
+               continue;
+            t = &tps->fips_bytes[c];
+            ones += k * t->ones;
+            poker[c>>4] += k;
+            poker[c&15] += k;
+            for (j=0;j<12;j++)
+               runs[j] += k * t->runs[j];
+            if (t->maxRun > maxRun)
+               maxRun = t->maxRun;
+            }
          /* 1 = monobit test  */
          k = (ones >= FIPS_ONES_HIGH || ones <= FIPS_ONES_LOW)? 1 : 0;
          p->results[tid].testResult = k | (1<<8);
@@ -749,9 +1329,48 @@ static H_UINT fips140(     /* RETURN: updated bit offset */
       }
    return offs;
 }
+/**
+ * Build the fips140 table entry for a byte value. The leading run is tallied
+ * by fips140() and each later run is tallied at the transition that ends it
+ * under the value of the following bit. Run lengths are kept as length - 1,
+ * as in the original bit by bit evaluation.
+ */
+static void fips140Setup(  /* RETURN: none               */
+   fipsByte *t,            /* OUT: the table entry       */
+   H_UINT b)               /* IN: the byte value         */
+{
+   H_UINT   bit, i, len, prev;
+
+   memset(t, 0, sizeof(fipsByte));
+   prev = (b>>7) & 1;
+   for (i=len=1;i<8;i++) {
+      bit = (b>>(7-i)) & 1;
+      if (bit==prev) {
+         len += 1;
+         continue;
+         }
+      if (0==t->lead)
+         t->lead = len;
+      else {
+         t->runs[(len-1) + 6*bit] += 1;
+         if ((len-1) > t->maxRun)
+            t->maxRun = len-1;
+         }
+      prev = bit;
+      len = 1;
+      }
+   if (0==t->lead)
+      t->lead = len;
+   t->trail = len;
+   for (i=0;i<8;i++)
+      t->ones += (b>>i) & 1;
+}
 /**
  * Procedure A disjointness test on 48 bit strings. Rejection probability for ideal
- * RNG is 2e^-17
+ * RNG is 2e^-17. Each string is inserted into an open-addressed hash set and the
+ * test fails on the first insert that finds its key already present. The reference
+ * sort and scan is retained under TEST0_QSORT. Either way, the final value is the
+ * number of bytes examined.
  */
 static H_UINT test0(       /* RETURN: updated bit offset */
    procA *p,               /* IN-OUT: the context        */
@@ -769,11 +1388,35 @@ static H_UINT test0(       /* RETURN: updated bit offset */
          if (p->testState!=TEST_EVAL)
             break;
       case TEST_EVAL:
+#ifdef TEST0_QSORT
+         if (p->view != p->aux)
+            memcpy(p->aux, p->view, TEST0_LENGTH*6);
          qsort(p->aux, TEST0_LENGTH, 6, test0cmp);
-         for (i=6,j=0;i<TEST0_LENGTH && j==0;i+=6)
+         for (i=6,j=0;i<(TEST0_LENGTH*6) && j==0;i+=6)
             if (!memcmp(p->aux+i-6, p->aux+i, 6)) {
                j=1;
                }
+#else
+         memset(p->hash, 0, sizeof(p->hash));
+         for (i=j=0;i<(TEST0_LENGTH*6) && j==0;i+=6) {
+            H_UINT8  *src = p->view + i;
+            uint64_t key, h;
+
+            /* bit 48 marks the slot in use so that a zero string is a valid key */
+            key = ((uint64_t)1<<48) |
+                  ((uint64_t)src[0]<<40) | ((uint64_t)src[1]<<32) | ((uint64_t)src[2]<<24) |
+                  ((uint64_t)src[3]<<16) | ((uint64_t)src[4]<<8)  |  (uint64_t)src[5];
+            h = (key * 0x9e3779b97f4a7c15ULL) >> (64 - TEST0_HASH_BITS);
+            while(p->hash[h]!=0) {
+               if (p->hash[h]==key) {
+                  j = 1;
+                  break;
+                  }
+               h = (h+1) & (TEST0_HASH_SIZE-1);
+               }
+            p->hash[h] = key;
+            }
+#endif
          p->results[tid].testResult = j;
          p->results[tid++].finalValue = i;
          p->testRun = tid;
@@ -781,6 +1424,7 @@ static H_UINT test0(       /* RETURN: updated bit offset */
       }
    return offs;
 }
+#ifdef TEST0_QSORT
 /**
  * Comparison method for the test0 sort
  */
@@ -788,6 +1432,7 @@ static int test0cmp(const void *aa, const void *bb)
 {
    return memcmp(aa,bb,6);
 }
+#endif
 /**
  * Procedure A autocorrelation test. Brutal bit twiddling. Uses same
  * data as FIPS - no update to bit offset
@@ -797,8 +1442,9 @@ static H_UINT test5(       /* RETURN: updated bit offset    */
    H_UINT offs,            /* IN: starting bit offset       */
    H_UINT tid)             /* IN: test id                   */
 {
-   H_UINT8  *dp = (H_UINT8 *)p->aux;
-   H_UINT j, k, max, tau, Z_tau;
+   uint64_t words[TEST5_WORDS];
+   H_UINT8  *dp = p->view;
+   H_UINT i, j, k, max, tau, Z_tau;
 
    /**
     * Because this test is so slow it can be skipped on one or more repetitions
@@ -813,17 +1459,20 @@ static H_UINT test5(       /* RETURN: updated bit offset    */
          }
       }
    /**
-    * This test always uses the same data as test1 through test4
+    * This test always uses the same data as test1 through test4. Pack
+    * it into an aligned copy so that the shifts can be done a word at a time.
     */
+   memset(words, 0, sizeof(words));
+   for (i=0;i<(FIPS_USED>>3);i++)
+      words[i>>3] |= (uint64_t)dp[i] << ((i & 7)<<3);
    for (max = k = 0,tau=1;tau<=TEST5_LENGTH;tau++){
-      Z_tau = abs(test5XOR(dp, tau) - 2500);
+      Z_tau = abs(test5XOR(words, 0, tau) - 2500);
       if (Z_tau > max) {
          max = Z_tau;
          k = tau - 1;
          }
       }
-   dp += TEST5_LENGTH/8;
-   Z_tau = test5XOR(dp, k + 1);
+   Z_tau = test5XOR(words, TEST5_LENGTH, k + 1);
    j = 5<<8; 
    if (( Z_tau <= 2326) || ( Z_tau >= 2674))
       j  |= 1;
@@ -841,28 +1490,31 @@ static H_UINT test5(       /* RETURN: updated bit offset    */
  *      rv += 1 & (((src[i>>3]>>(i & 7))) ^ ((src[j>>3]>>(j & 7))));
  *   return rv;
  *
- * A high performance optimization using multi-byte casts is 3x as fast as the above but blows up
- * because of alignment issues (leftovers from the test0 implementation)
- * The optimized single byte optimization is 2x as fast as the above but uses no alignment games
+ * A multi-byte version of the above blew up because of alignment issues (leftovers
+ * from the test0 implementation). test5() now packs the input into an aligned
+ * array of 64 bit words, least significant bit first, so the bit order of the
+ * reference is kept on any byte order. Each step compares 64 bits using a funnel
+ * shift to extract the words at the two bit offsets.
  */
-static H_UINT test5XOR(H_UINT8 *src, H_UINT shift)
+#define  TEST5_WORD(w,b)   (0==((b)&63)? (w)[(b)>>6] :\
+                              ((w)[(b)>>6]>>((b)&63)) | ((w)[((b)>>6)+1]<<(64-((b)&63))))
+
+static H_UINT test5XOR(    /* RETURN: number of differing bits */
+   uint64_t *src,          /* IN: packed input                 */
+   H_UINT first,           /* IN: bit offset of the window     */
+   H_UINT shift)           /* IN: the shift                    */
 {
-   H_UINT8  *src1;
-   H_UINT   i,rest, rv;
-   
-   src1 = src + (shift>>3);
-   shift &= 7;
-   rest = 8 - shift;
-   for(i=rv=0;i<(TEST5_LENGTH>>3);i++) {
-      H_UINT8 lw   = *src++;
-      H_UINT8 rw   = *src1++;
-      H_UINT8 w;
-
-      for (w = (lw & (0xff>>shift)) ^ (rw>>shift);w!=0;w>>=1)
-         rv += w & 1;
-      for (w = (lw>>rest) ^ (*src1 & (0xff>>rest));w!=0;w>>=1)
-         rv += w & 1;
+   H_UINT   i, rv;
+   uint64_t w;
+
+   for(i=rv=0;i<(TEST5_LENGTH>>6);i++) {
+      w = TEST5_WORD(src, first) ^ TEST5_WORD(src, first+shift);
+      POPCOUNT64(rv, w);
+      first += 64;
       }
+   w = (TEST5_WORD(src, first) ^ TEST5_WORD(src, first+shift)) &
+       (((uint64_t)1<<(TEST5_LENGTH & 63))-1);
+   POPCOUNT64(rv, w);
    return rv;
 }
 /**
@@ -943,6 +1595,13 @@ static H_UINT test6a(      /* RETURN: bit offset      */
  * Procedure B entropy estimator (Coron). Find the distribution of the distance between
  * bytes and their predecessors. Fixed input size, no deadman needed.
  */
+#define  TEST8_FILL(c)     for(;t<m;t++) lastpos[c] = k++
+#define  TEST8_SUM(c)      for(;t<m;t++) {\
+                              b = c;\
+                              TG += G[k - lastpos[b]];\
+                              lastpos[b] = k++;\
+                              }
+#define  TEST8_SHIFT(t)    ((0xff & (src[t]<<(8-align))) | (src[(t)+1]>>align))
 static H_UINT test8(       /* RETURN: bit offset      */
    procShared  *tps,       /* IN-OUT: shared data     */
    procB *p,               /* IN-OUT: the context     */
@@ -961,7 +1620,7 @@ static H_UINT test8(       /* RETURN: bit offset      */
          RESTORE8(k,j,hilf,TG);
          r = p->range - offs;
          {
-            H_UINT align;
+            H_UINT align, n;
             /* gobble bits up to a byte boundary */
             BITSTREAM_OPEN(p->noise,offs);
             for(;j<8 && i<r && bitstream_in!=0x80;i++,j++) {
@@ -969,9 +1628,14 @@ static H_UINT test8(       /* RETURN: bit offset      */
                }
             align  = (j &= 7);
             while(i<r) {
-               if (j==0 && (i+8)<r) {     /* gobble a byte     */
-                  hilf = (0xff & (bitstream_src[0]<<(8-align))) | (bitstream_src[1]>>align);
-                  bitstream_src++;i+=8;j=8;
+               if (j==0 && (i+8)<r) {     /* gobble bytes      */
+                  n = test8Bytes(tps, p, bitstream_src, align, (r-i-1)>>3, &k, &TG);
+                  bitstream_src += n;
+                  i += n<<3;
+                  if (k==(K+Q)) {
+                     p->testState = TEST_EVAL;
+                     break;
+                     }
                   }
                for(;j<8 && i<r;i++,j++) { /* gobble loose bits */
                   hilf += hilf+(BITSTREAM_BIT());BITSTREAM_NEXT();
@@ -1007,4 +1671,43 @@ static H_UINT test8(       /* RETURN: bit offset      */
       }
    return i+offs;
 }
+/**
+ * Bulk symbol processing for test8(). Consumes up to n symbols, each assembled from
+ * the bytes at src with the shift in align, and stops early once the test has
+ * all K+Q symbols. The addition order into TG is unchanged, so the result does
+ * not depend on how the input was segmented. Note an aligned input is read one
+ * byte ahead, as the original byte gobbler did.
+ */
+static H_UINT test8Bytes(  /* RETURN: symbols used       */
+   procShared  *tps,       /* IN: shared data            */
+   procB *p,               /* IN-OUT: the context        */
+   H_UINT8 *src,           /* IN: input position         */
+   H_UINT align,           /* IN: bit alignment          */
+   H_UINT n,               /* IN: symbols available      */
+   H_UINT *pk,             /* IN-OUT: symbol index       */
+   double *pTG)            /* IN-OUT: sum of G           */
+{
+   H_UINT   *lastpos = p->lastpos;
+   double   *G = tps->G;
+   double   TG = *pTG;
+   H_UINT   b, k = *pk, m, t = 0;
+
+   m = k>=Q? 0 : (Q-k)<n? (Q-k) : n;
+   if (0==align) {
+      TEST8_FILL(src[t+1]);
+      }
+   else {
+      TEST8_FILL(TEST8_SHIFT(t));
+      }
+   m = (K+Q-k)<(n-t)? t+(K+Q-k) : n;
+   if (0==align) {
+      TEST8_SUM(src[t+1]);
+      }
+   else {
+      TEST8_SUM(TEST8_SHIFT(t));
+      }
+   *pk  = k;
+   *pTG = TG;
+   return t;
+}
 #endif
@@ -70,7 +70,14 @@ typedef enum {
  */
 #define  TEST0_LENGTH      65536
 #define  TEST0_USED        (TEST0_LENGTH * 48)
+/**
+ * test 0 detects duplicates with an open-addressed hash set kept at a load
+ * factor of 1/2. Define TEST0_QSORT to use the reference sort and scan instead.
+ */
+#define  TEST0_HASH_BITS   17
+#define  TEST0_HASH_SIZE   (1<<TEST0_HASH_BITS)
 #define  TEST5_LENGTH      5000
+#define  TEST5_WORDS       ((FIPS_USED>>6)+2)
 /**
  * Fixed size input for procedure A
  */
@@ -84,10 +91,11 @@ typedef struct {
 } resultA;
 /**
  * AIS-31 procedure A context. Options are defined in haveged.h
- * This puppy weighs in at ~3 MB.
+ * This puppy weighs in at ~4 MB.
  */
 typedef struct {
    H_UINT8  *data;               /* input for test             */         
+   H_UINT8  *view;               /* input window being tested  */
    H_UINT   range;               /* number of bits of input    */
    H_UINT   procState;           /* procedure state            */
    H_UINT   procRetry;           /* retry indication           */
@@ -98,6 +106,7 @@ typedef struct {
    H_UINT   bytesUsed;           /* number of bytes used       */
    H_UINT   options;             /* duty cycle for test5       */
    H_UINT8  aux[TEST0_USED];     /* extra work space           */
+   uint64_t hash[TEST0_HASH_SIZE]; /* test0 hash set            */
    resultA  results[1286];       /* test results               */
    } procA;
 /**
@@ -154,8 +163,44 @@ typedef struct {
 #define  B_WARN     0x00001000   /* Only warn of B fails       */
 #define  B_RUN      0x00002000   /* Run proceure B             */
 #define  B_OPTIONS  0x00001000
+#define  H_WARN     0x00004000   /* Only warn of health fails  */
+#define  H_RUN      0x00008000   /* Run health tests           */
+#define  H_OPTIONS  0x00004000
 #define  X_OPTIONS  0x000f0000   /* isolated test index        */
 #define  X_RUN      0x00100000   /* diagnostic isolated test   */
+/**
+ * SP 800-90B health tests on the bytes of every continuous fill. HEALTH_H is the
+ * min-entropy assumed per byte and the false positive rate is 2^-HEALTH_ALPHA
+ * per byte. The repetition count cutoff follows directly, the adaptive proportion
+ * cutoff for a window of HEALTH_APT_W bytes is computed from the binomial tail.
+ */
+#ifndef  HEALTH_H
+#define  HEALTH_H          8
+#endif
+#define  HEALTH_ALPHA      40
+#define  HEALTH_APT_W      512
+/**
+ * Continuous test sampling. If a CPU budget is configured, whole buffers are
+ * released untested after a procedure passes on its first attempt, as many as
+ * needed to keep test time within the budget share of collection time. Buffers
+ * are never skipped after a failure or retry, and no more than S_SKIP_MAX in a row.
+ * Skipped buffers are held until the next tested window passes and are dropped if
+ * it fails, so S_SKIP_MAX also bounds the hold of each collector.
+ */
+#define  S_SKIP_MAX 16           /* longest run of skipped fills */
+/**
+ * Run structure of a byte for the table driven fips140 tests. Bits are taken
+ * MSB first. The leading and trailing runs may continue into the neighbouring
+ * bytes, the runs between them are complete and are tallied in runs[] the way
+ * fips140() counts them.
+ */
+typedef struct {
+   H_UINT8  lead;                /* length of leading run      */
+   H_UINT8  trail;               /* length of trailing run     */
+   H_UINT8  maxRun;              /* longest inner run - 1      */
+   H_UINT8  ones;                /* number of bits set         */
+   H_UINT8  runs[12];            /* inner run counters         */
+  } fipsByte;
 /**
  * A test procedure run consists of an indicator and options
  */
@@ -164,11 +209,24 @@ typedef struct {
    H_UINT   options;             /* WARN and other options    */
   } procInst;
 
+/**
+ * Diagnostic builds (RAW_IN_ENABLE) accumulate the CPU time used by each test in
+ * procShared for benchmarks driven by H_DEBUG_TEST_IN. The aisSeq() slot covers
+ * test6b, test7a, and test7b.
+ */
+#define  TIME_TEST0        0     /* disjointedness test        */
+#define  TIME_FIPS         1     /* test1 through test4        */
+#define  TIME_TEST5        2     /* autocorrelation test       */
+#define  TIME_TEST6A       3     /* test6a                     */
+#define  TIME_SEQ          4     /* aisSeq() tests             */
+#define  TIME_TEST8        5     /* Coron's test               */
+#define  TIME_SLOTS        6
 /**
  * Services provided
  */
 typedef int   (*ptrDiscard)(H_COLLECT *rdr);
 typedef void  (*ptrReport)(H_COLLECT * h_ctxt, H_UINT action, H_UINT prod, H_UINT state, H_UINT ct);
+typedef int   (*ptrRelease)(H_COLLECT *rdr);
 typedef int   (*ptrRun)(H_COLLECT *rdr, H_UINT prod);
 
 /**
@@ -179,20 +237,28 @@ typedef int   (*ptrRun)(H_COLLECT *rdr, H_UINT prod);
  */
 typedef struct {
    ptrDiscard     discard;                   /* release test resources     */
+   ptrRelease     release;                   /* serve a held fill          */
    ptrRun         run;                       /* run test suite             */
    ptrReport      report;                    /* report test results        */
    H_UINT         options;                   /* verbosity, etc.            */
    H_UINT         testsUsed;                 /* tests used                 */
+   H_UINT         budget;                    /* cont test cpu share (%)    */
+   H_UINT         health;                    /* health test options        */
+   H_UINT         rctCutoff;                 /* repetition count limit     */
+   H_UINT         aptCutoff;                 /* adaptive proportion limit  */
    procInst       totTests[2];               /* tot tests to run           */
    procInst       runTests[2];               /* production tests to run    */
    H_UINT         procReps;                  /* Number of  A repetitions   */
    H_UINT         fips_low[6];               /* low runs thresholds        */
    H_UINT         fips_high[6];              /* high runs thresholds       */
-   char           totText[8];                /* tot test text rep          */
-   char           prodText[8];               /* production test text rep   */
-   H_UINT         meters[H_OLT_PROD_B_P+1];  /* test counters              */
+   fipsByte       fips_bytes[256];           /* fips140 byte table         */
+   char           totText[12];               /* tot test text rep          */
+   char           prodText[12];              /* production test text rep   */
+   H_UINT         meters[H_OLT_PROD_H_P+1];  /* test counters              */
+   H_UINT         coverage[2];               /* cont fills tested, skipped */
    double         lastCoron;                 /* last test8 result          */
    double         *G;                        /* test8 lookup table         */
+   double         cpuTime[2][TIME_SLOTS];    /* [tot|prod] test cpu secs   */
 } procShared;
 /**
  * How to get test context and shared data from H_COLLECT
@@ -209,8 +275,22 @@ typedef struct {
    H_UINT      runIdx;           /* run test idx               */
    H_UINT      szCarry;          /* bits carried in next proc  */
    H_UINT      szTotal;          /* total bits processed       */
+   H_UINT      skip;             /* fills left to skip         */
+   H_UINT      skipped;          /* nz if fill not tested      */
+   H_UINT      wFills;           /* fills in current window    */
+   H_UINT      held;             /* skipped fills in hold      */
+   H_UINT      freed;            /* nz if held fills passed    */
+   H_UINT      *hold;            /* skipped fill hold          */
+   H_UINT      tCollect;         /* avg collection ticks       */
+   H_UINT      tTest;            /* avg test ticks             */
+   H_UINT      rctLast;          /* repetition count sample    */
+   H_UINT      rctRun;           /* repetition count           */
+   H_UINT      aptSample;        /* adaptive proportion sample */
+   H_UINT      aptCount;         /* adaptive proportion count  */
+   H_UINT      aptIdx;           /* adaptive proportion index  */
    procA       *pA;              /* procedure A instance       */
    procB       *pB;              /* procedure B instance       */
+   void        *tot;             /* concurrent tot state       */
 } onlineTests;
 /**
  * Default options are to run the tot tests.
@@ -35,6 +35,7 @@
  */
 #define  BUILD_CLOCK    'C'
 #define  BUILD_DIAGS    'D'
+#define  BUILD_ESTIMATE 'E'
 #define  BUILD_CPUID    'I'
 #define  BUILD_THREADS  'M'
 #define  BUILD_OLT      'T'
@@ -183,11 +184,14 @@ void havege_tune(          /* RETURN: none               */
 #if defined(RAW_IN_ENABLE) || defined(RAW_OUT_ENABLE)
    *bp++ = BUILD_DIAGS;
 #endif
+#ifdef ENTROPY_ESTIMATE_ENABLE
+   *bp++ = BUILD_ESTIMATE;
+#endif
 #ifdef TUNING_CPUID_ENABLE
    *bp++ = BUILD_CPUID;
 #endif
 #if NUMBER_CORES>1
-   *bp++ = BUILD_THREAD;
+   *bp++ = BUILD_THREADS;
 #endif
 #ifdef ONLINE_TESTS_ENABLE
    *bp++ = BUILD_OLT;